@@ -0,0 +1,76 @@
+/**
+ \file 		allocation_hook.cpp
+ \author	oliver.schick92@gmail.com
+ \copyright	ABY - A Framework for Efficient Mixed-protocol Secure Two-party Computation
+ Copyright (C) 2019 Engineering Cryptographic Protocols Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+            it under the terms of the GNU Lesser General Public License as published
+            by the Free Software Foundation, either version 3 of the License, or
+            (at your option) any later version.
+            ABY is distributed in the hope that it will be useful,
+            but WITHOUT ANY WARRANTY; without even the implied warranty of
+            MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+            GNU Lesser General Public License for more details.
+            You should have received a copy of the GNU Lesser General Public License
+            along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//Replaces the global operator new and delete of the executable it is linked
+//into by ones counting the allocations, see allocation_counter.
+
+#include "memory.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace{
+
+//constant initialized, so allocations before the dynamic initialization
+//are counted as well
+allocation_counter allocation_count;
+
+struct registration{
+    registration(){
+        set_allocation_counter(&allocation_count);
+    }
+} const registered;
+
+//every allocation is prefixed by its size, in a block keeping the alignment
+//of the allocation
+constexpr std::size_t allocation_header = alignof(std::max_align_t);
+
+}
+
+void* operator new(std::size_t size){
+    void* const p = std::malloc(size + allocation_header);
+    if(p == nullptr){
+        throw std::bad_alloc();
+    }
+    *static_cast<std::size_t*>(p) = size;
+    allocation_count.allocated(size);
+    return static_cast<char*>(p) + allocation_header;
+}
+
+void operator delete(void* p) noexcept{
+    if(p != nullptr){
+        void* const block = static_cast<char*>(p) - allocation_header;
+        allocation_count.freed(*static_cast<std::size_t*>(block));
+        std::free(block);
+    }
+}
+
+void* operator new[](std::size_t size){
+    return operator new(size);
+}
+
+void operator delete[](void* p) noexcept{
+    operator delete(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept{
+    operator delete(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept{
+    operator delete(p);
+}
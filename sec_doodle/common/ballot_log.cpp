@@ -0,0 +1,176 @@
+/**
+ \file 		ballot_log.cpp
+ \author	oliver.schick92@gmail.com
+ \copyright	ABY - A Framework for Efficient Mixed-protocol Secure Two-party Computation
+ Copyright (C) 2019 Engineering Cryptographic Protocols Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+            it under the terms of the GNU Lesser General Public License as published
+            by the Free Software Foundation, either version 3 of the License, or
+            (at your option) any later version.
+            ABY is distributed in the hope that it will be useful,
+            but WITHOUT ANY WARRANTY; without even the implied warranty of
+            MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+            GNU Lesser General Public License for more details.
+            You should have received a copy of the GNU Lesser General Public License
+            along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ballot_log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace{
+
+constexpr char log_magic[8] = {'S', 'D', 'B', 'L', 'O', 'G', '0', '2'};
+
+std::size_t bitmap_size(std::size_t const num_participants){
+    //whole words, so the rows following the bitmap stay aligned
+    return (num_participants + 63) / 64 * sizeof(uint64_t);
+}
+
+//maps size bytes of fd or anonymous memory if fd is negative, fd is closed
+//if the mapping fails
+void* map_log(int const fd, std::size_t const size, std::string const& path){
+    int const flags = fd < 0 ? MAP_SHARED | MAP_ANONYMOUS : MAP_SHARED;
+    void* const mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if(mem == MAP_FAILED){
+        int const err = errno;
+        if(fd >= 0){
+            close(fd);
+        }
+        throw std::runtime_error("could not map ballot log " + path + ": " + std::strerror(err));
+    }
+    return mem;
+}
+
+}
+
+ballot_log::ballot_log(
+    std::string const& path,
+    std::size_t const num_participants,
+    std::size_t const num_columns,
+    unsigned char const encoding
+)
+: fd_(-1),
+  size_(sizeof(header) + bitmap_size(num_participants) + num_participants * num_columns * sizeof(doodle_entry)),
+  header_(nullptr){
+    static_assert(sizeof(header) % sizeof(doodle_entry) == 0, "rows have to be aligned");
+    if(!path.empty()){
+        fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if(fd_ < 0){
+            throw std::runtime_error("could not create ballot log " + path + ": " + std::strerror(errno));
+        }
+        if(ftruncate(fd_, size_) != 0){
+            int const err = errno;
+            close(fd_);
+            throw std::runtime_error("could not allocate ballot log " + path + ": " + std::strerror(err));
+        }
+    }
+    header_ = static_cast<header*>(map_log(fd_, size_, path));
+    //a new file and an anonymous mapping are zero-filled, so only the header
+    //has to be written
+    std::memcpy(header_->magic, log_magic, sizeof(log_magic));
+    header_->num_participants = num_participants;
+    header_->num_columns = num_columns;
+    header_->num_rows = 0;
+    header_->num_ballots = 0;
+    header_->encoding = encoding;
+}
+
+ballot_log::ballot_log(std::string const& path)
+: fd_(open(path.c_str(), O_RDWR)),
+  size_(0),
+  header_(nullptr){
+    if(fd_ < 0){
+        throw std::runtime_error("could not open ballot log " + path + ": " + std::strerror(errno));
+    }
+    header h;
+    off_t const file_size = lseek(fd_, 0, SEEK_END);
+    if(file_size < off_t(sizeof(h)) || pread(fd_, &h, sizeof(h), 0) != ssize_t(sizeof(h))){
+        close(fd_);
+        throw std::runtime_error("could not read the header of ballot log " + path);
+    }
+    //the sizes are checked by division, so a damaged header cannot overflow
+    std::size_t const row_bytes = h.num_columns * sizeof(doodle_entry);
+    bool const valid = std::memcmp(h.magic, log_magic, sizeof(log_magic)) == 0
+        && h.num_participants != 0 && h.num_participants <= std::size_t(file_size)
+        && h.num_columns != 0 && h.num_columns <= std::size_t(file_size) / sizeof(doodle_entry)
+        && std::size_t(file_size) >= sizeof(header) + bitmap_size(h.num_participants)
+        && (std::size_t(file_size) - sizeof(header) - bitmap_size(h.num_participants)) == h.num_participants * row_bytes
+        && (std::size_t(file_size) - sizeof(header) - bitmap_size(h.num_participants)) / row_bytes == h.num_participants;
+    if(!valid){
+        close(fd_);
+        throw std::runtime_error("invalid ballot log " + path);
+    }
+    size_ = file_size;
+    header_ = static_cast<header*>(map_log(fd_, size_, path));
+    //the counters are updated after the bitmap, see write, so they are
+    //recounted in case the previous run stopped in between
+    header_->num_rows = 0;
+    header_->num_ballots = 0;
+    for(std::size_t i = 0; i < h.num_participants; ++i){
+        if(has_voted_(i)){
+            ++header_->num_ballots;
+            header_->num_rows = i + 1;
+        }
+    }
+}
+
+ballot_log::~ballot_log() noexcept{
+    munmap(header_, size_);
+    if(fd_ >= 0){
+        close(fd_);
+    }
+}
+
+uint64_t* ballot_log::voted_() const noexcept{
+    return reinterpret_cast<uint64_t*>(reinterpret_cast<unsigned char*>(header_) + sizeof(header));
+}
+
+bool ballot_log::has_voted_(std::size_t const participant) const noexcept{
+    return (voted_()[participant / 64] >> (participant % 64) & 1) != 0;
+}
+
+doodle_entry* ballot_log::rows_() const noexcept{
+    return reinterpret_cast<doodle_entry*>(
+        reinterpret_cast<unsigned char*>(header_) + sizeof(header) + bitmap_size(header_->num_participants)
+    );
+}
+
+doodle_entry const* ballot_log::find(std::size_t const participant) const noexcept{
+    return has_voted_(participant) ? rows_() + participant * header_->num_columns : nullptr;
+}
+
+void ballot_log::write(std::size_t const participant, doodle_entry const* const row) noexcept{
+    //the row is written before it is marked and counted, so the log stays
+    //consistent if the server stops in between
+    std::copy(row, row + header_->num_columns, rows_() + participant * header_->num_columns);
+    if(!has_voted_(participant)){
+        voted_()[participant / 64] |= uint64_t(1) << (participant % 64);
+        ++header_->num_ballots;
+        header_->num_rows = std::max<uint64_t>(header_->num_rows, participant + 1);
+    }
+}
+
+doodle_table_view ballot_log::table() const noexcept{
+    return doodle_table_view(rows_(), nullptr, header_->num_rows, header_->num_columns, 0);
+}
+
+std::vector<bool> ballot_log::participant_nos(std::vector<bool> const& row_nos) const{
+    //only the server learns the no-sayers
+    if(row_nos.empty()){
+        return row_nos;
+    }
+    std::vector<bool> nos(header_->num_participants, false);
+    for(std::size_t i = 0; i < row_nos.size(); ++i){
+        nos[i] = row_nos[i] && has_voted_(i);
+    }
+    return nos;
+}
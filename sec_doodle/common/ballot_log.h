@@ -0,0 +1,113 @@
+/**
+ \file 		ballot_log.h
+ \author	oliver.schick92@gmail.com
+ \copyright	ABY - A Framework for Efficient Mixed-protocol Secure Two-party Computation
+ Copyright (C) 2019 Engineering Cryptographic Protocols Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+            it under the terms of the GNU Lesser General Public License as published
+            by the Free Software Foundation, either version 3 of the License, or
+            (at your option) any later version.
+            ABY is distributed in the hope that it will be useful,
+            but WITHOUT ANY WARRANTY; without even the implied warranty of
+            MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+            GNU Lesser General Public License for more details.
+            You should have received a copy of the GNU Lesser General Public License
+            along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ABY_SEC_DOODLE_BALLOT_LOG_H_19102026_1120
+#define ABY_SEC_DOODLE_BALLOT_LOG_H_19102026_1120
+
+#include "sec_doodle.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//memory mapped log of the ballots of one poll, stored in the row format of
+//doodle_table. The ballot of a participant is stored in the row of the same
+//index and later ballots overwrite it, so the rows are in the same order on
+//both servers however the ballots arrived and can be evaluated in place once
+//the poll is closed. Rows of participants who have not voted are zero, which
+//is a yes to every time slot in both encodings and so does not change the
+//column sums. The file is created with its final size and filled sparsely,
+//so writing a ballot needs no reallocation. A log kept in a file is reopened
+//by the next run of the server, so the ballots survive a restart.
+//
+//layout: header | bitmap of the participants who voted | rows
+class ballot_log{
+public:
+    //creates the log in the file at path, replacing an existing one;
+    //an empty path keeps the log in anonymous memory
+    ballot_log(
+        std::string const& path,
+        std::size_t num_participants,
+        std::size_t num_columns,
+        unsigned char encoding
+    );
+    
+    //reopens the log in the file at path as left by a previous run
+    explicit ballot_log(std::string const& path);
+    
+    ballot_log(ballot_log const&) = delete;
+    
+    ballot_log& operator=(ballot_log const&) = delete;
+    
+    ~ballot_log() noexcept;
+    
+    std::size_t num_participants() const noexcept{
+        return header_->num_participants;
+    }
+    
+    std::size_t num_columns() const noexcept{
+        return header_->num_columns;
+    }
+    
+    unsigned char encoding() const noexcept{
+        return static_cast<unsigned char>(header_->encoding);
+    }
+    
+    //number of participants who have voted
+    std::size_t num_ballots() const noexcept{
+        return header_->num_ballots;
+    }
+    
+    //the last ballot of participant or nullptr if they have not voted yet
+    doodle_entry const* find(std::size_t participant) const noexcept;
+    
+    //the row of the last ballot of participant, who has to have voted
+    std::size_t row_index(std::size_t participant) const noexcept{
+        return participant;
+    }
+    
+    //stores the ballot of participant, row has num_columns() entries
+    void write(std::size_t participant, doodle_entry const* row) noexcept;
+    
+    //the rows of the participants up to the last one who voted
+    doodle_table_view table() const noexcept;
+    
+    //maps the no-sayers of the rows of table() to the participants
+    std::vector<bool> participant_nos(std::vector<bool> const& row_nos) const;
+    
+private:
+    struct header{
+        char magic[8];
+        uint64_t num_participants;
+        uint64_t num_columns;
+        uint64_t num_rows;
+        uint64_t num_ballots;
+        uint64_t encoding;
+    };
+    
+    uint64_t* voted_() const noexcept;
+    
+    bool has_voted_(std::size_t participant) const noexcept;
+    
+    doodle_entry* rows_() const noexcept;
+    
+    int fd_;
+    std::size_t size_;
+    header* header_;
+};
+
+#endif
@@ -23,7 +23,16 @@
 #include <abycore/circuit/circuit.h>
 #include <abycore/aby/abyparty.h>
 #include <cassert>
+#include <deque>
+#include <initializer_list>
 #include <limits>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <tuple>
 
 namespace faby{
     
@@ -49,59 +58,91 @@ namespace faby{
     } identity;
 
 
-    template<typename RandomIt, typename BinaryOperation, typename LeafTransformation>
-    auto tree_accumulate_impl(RandomIt first, RandomIt last, BinaryOperation& op, LeafTransformation& leaftransformation)
-    -> decltype(op(leaftransformation(*first), leaftransformation(*first))){
-        return (last - first) == 1 ?
-            leaftransformation(*first)
-            : op(
-                tree_accumulate_impl(first, first + (last - first)/2, op, leaftransformation),
-                tree_accumulate_impl(first + (last - first)/2, last, op , leaftransformation)
-              );
-    }
-
-    template<typename RandomIt, typename BinaryOperation, typename LeafTransformation>
-    auto tree_accumulate_impl_with_idx(
-        RandomIt first, 
-        RandomIt last, 
-        BinaryOperation& op, 
-        LeafTransformation& leaftransformation,
-        RandomIt& base
-    ) -> decltype(op(leaftransformation(*first, std::size_t()), leaftransformation(*first, std::size_t()))){
-        return (last - first) == 1 ?
-                    leaftransformation(*first, first - base)
-                    : op(
-                        tree_accumulate_impl_with_idx(first, first + (last - first)/2, op, leaftransformation, base),
-                        tree_accumulate_impl_with_idx(first + (last - first)/2, last, op, leaftransformation, base)
-                      );
-            
+    //combines the adjacent pairs of a tree level from left to right into the
+    //next level, an odd last value is passed on unchanged
+    template<typename BinaryOperation>
+    struct pairwise_level_t{
+        BinaryOperation& op;
+        
+        template<typename T>
+        void operator()(std::vector<T>& level) const{
+            std::size_t const size = level.size();
+            for(std::size_t i = 0; i + 1 < size; i += 2){
+                level[i / 2] = op(std::move(level[i]), std::move(level[i + 1]));
+            }
+            if(size % 2 == 1){
+                level[size / 2] = std::move(level.back());
+            }
+            level.erase(level.begin() + (size + 1) / 2, level.end());
+        }
+    };
+    
+    template<typename BinaryOperation>
+    pairwise_level_t<BinaryOperation> pairwise_level(BinaryOperation& op){
+        return pairwise_level_t<BinaryOperation>{op};
     }
-
+    
     template<
-        typename RandomIt, 
-        typename BinaryOperation, 
-        typename LeafTransformation = decltype(identity)&,
-        std::enable_if_t<
-            is_invokable<LeafTransformation(decltype(*std::declval<RandomIt>()))>::value &&
-            !is_invokable<LeafTransformation(decltype(*std::declval<RandomIt>()), std::size_t)>::value
-        >* = nullptr
+        typename LeafTransformation, 
+        typename T,
+        std::enable_if_t<!is_invokable<LeafTransformation&(T, std::size_t)>::value>* = nullptr
     >
-    auto tree_accumulate(RandomIt first, RandomIt last, BinaryOperation&& op, LeafTransformation&& leaftransformation = identity){
-        return tree_accumulate_impl(first, last, op, leaftransformation);
+    decltype(auto) apply_leaf(LeafTransformation& leaftransformation, T&& t, std::size_t){
+        return leaftransformation(std::forward<T>(t));
     }
-
+    
     template<
-        typename RandomIt, 
-        typename BinaryOperation, 
-        typename LeafTransformation = decltype(identity)&,
-        std::enable_if_t<
-            is_invokable<LeafTransformation(decltype(*std::declval<RandomIt>()), std::size_t)>::value
-        >* = nullptr
+        typename LeafTransformation, 
+        typename T,
+        std::enable_if_t<is_invokable<LeafTransformation&(T, std::size_t)>::value>* = nullptr
     >
-    auto tree_accumulate(RandomIt first, RandomIt last, BinaryOperation&& op, LeafTransformation&& leaftransformation = identity){
-        return tree_accumulate_impl_with_idx(first, last, op, leaftransformation, first);
+    decltype(auto) apply_leaf(LeafTransformation& leaftransformation, T&& t, std::size_t idx){
+        return leaftransformation(std::forward<T>(t), idx);
+    }
+    
+    //Reduces [first, last) breadth first: the leaves are leaftransformation
+    //of the elements (and of their index, if it takes one) and every step
+    //hands a whole level to level_op, which reduces it in place to the next
+    //level. So the gates are put in the order of the layers of the circuit.
+    //Throws std::invalid_argument for an empty range, which has no result.
+    template<typename InputIt, typename LevelOperation, typename LeafTransformation>
+    auto tree_accumulate_by_level(
+        InputIt first, 
+        InputIt last, 
+        LevelOperation&& level_op, 
+        LeafTransformation&& leaftransformation
+    ){
+        using leaf_t = decltype(apply_leaf(leaftransformation, *first, std::size_t()));
+        using value_t = std::decay_t<leaf_t>;
+        if(first == last){
+            throw std::invalid_argument("tree_accumulate of an empty range");
+        }
+        std::vector<value_t> level;
+        std::size_t idx = 0;
+        for(; first != last; ++first, ++idx){
+            level.emplace_back(apply_leaf(leaftransformation, *first, idx));
+        }
+        while(level.size() > 1){
+            level_op(level);
+        }
+        return std::move(level.front());
+    }
+    
+    template<typename InputIt, typename BinaryOperation, typename LeafTransformation = decltype(identity)&>
+    auto tree_accumulate(InputIt first, InputIt last, BinaryOperation&& op, LeafTransformation&& leaftransformation = identity){
+        return tree_accumulate_by_level(first, last, pairwise_level(op), leaftransformation);
     }
             
+    template<typename Range, typename LevelOperation, typename LeafTransformation = decltype(identity)&>
+    auto tree_accumulate_by_level(Range range, LevelOperation&& level_op, LeafTransformation&& leaftransformation = identity){
+        return tree_accumulate_by_level(
+            range.begin(), 
+            range.end(), 
+            std::forward<LevelOperation>(level_op), 
+            std::forward<LeafTransformation>(leaftransformation)
+        );
+    }
+    
     template<typename RandomAccessRange, typename BinaryOperation, typename LeafTransformation = decltype(identity)&>
     auto tree_accumulate(RandomAccessRange range, BinaryOperation&& op, LeafTransformation&& leaftransformation = identity){
         return tree_accumulate(
@@ -155,6 +196,452 @@ namespace faby{
     template<typename>
     struct faby_context;
     
+    //Owns the ABY shares created through faby on the calling thread while it
+    //is the innermost arena of the thread and deletes all of them at once
+    //when it is destroyed, so it has to outlive the execution and the reading
+    //of the outputs of the circuit. Without an arena shares are not deleted.
+    class share_arena{
+    public:
+        share_arena()
+        : previous_(current_()){
+            current_() = this;
+        }
+        
+        share_arena(share_arena const&) = delete;
+        share_arena& operator=(share_arena const&) = delete;
+        
+        ~share_arena(){
+            current_() = previous_;
+            //shares wrapped several times are only deleted once
+            std::sort(shares_.begin(), shares_.end());
+            shares_.erase(std::unique(shares_.begin(), shares_.end()), shares_.end());
+            for(share* s : shares_){
+                delete s;
+            }
+        }
+        
+        static void track(share* s){
+            if(share_arena* const arena = current_()){
+                arena->shares_.emplace_back(s);
+            }
+        }
+        
+    private:
+        static share_arena*& current_(){
+            static thread_local share_arena* current = nullptr;
+            return current;
+        }
+        
+        share_arena* previous_;
+        std::vector<share*> shares_;
+    };
+    
+    
+    //While it is the innermost census of the calling thread, counts the bit
+    //lengths faby chose for the shares of boolean circuits from their maximum
+    //values, the conversions between sharings and the input bits, to see
+    //where the gates of a circuit come from.
+    class share_census{
+    public:
+        share_census()
+        : previous_(current_()){
+            current_() = this;
+        }
+        
+        share_census(share_census const&) = delete;
+        share_census& operator=(share_census const&) = delete;
+        
+        ~share_census(){
+            current_() = previous_;
+        }
+        
+        //number of shares by bit length
+        std::map<uint32_t, uint64_t> bit_widths;
+        //number of conversions by kind, e.g. "y2b"
+        std::map<std::string, uint64_t> conversions;
+        uint64_t input_bits = 0;
+        
+        static void count_width(uint32_t const bitlen){
+            if(share_census* const census = current_()){
+                ++census->bit_widths[bitlen];
+            }
+        }
+        
+        static void count_conversion(char const* const kind){
+            if(share_census* const census = current_()){
+                ++census->conversions[kind];
+            }
+        }
+        
+        static void count_input(uint32_t const bitlen){
+            if(share_census* const census = current_()){
+                census->input_bits += bitlen;
+            }
+        }
+        
+    private:
+        static share_census*& current_(){
+            static thread_local share_census* current = nullptr;
+            return current;
+        }
+        
+        share_census* previous_;
+    };
+    
+    
+    //While it is the innermost pool of the calling thread, constants of the
+    //same value and width are put as one CONS gate. Every constant still gets
+    //its own share object, as shares are modified in place (e.g. set_bitlength).
+    //The gates of a circuit are gone after Reset(), so a pool must not span
+    //more than one execution.
+    class constant_pool{
+    public:
+        constant_pool()
+        : previous_(current_()){
+            current_() = this;
+        }
+        
+        constant_pool(constant_pool const&) = delete;
+        constant_pool& operator=(constant_pool const&) = delete;
+        
+        ~constant_pool(){
+            current_() = previous_;
+        }
+        
+        static share* put_constant(ABYCircuit* circ, uint64_t val, uint32_t bitlen){
+            constant_pool* const pool = current_();
+            if(pool == nullptr){
+                return circ->PutCONSGate(val, bitlen);
+            }
+            auto const key = std::make_tuple(circ, val, bitlen);
+            auto const it = pool->wires_.find(key);
+            if(it != pool->wires_.end()){
+                return create_new_share(it->second, circ);
+            }
+            share* const s = circ->PutCONSGate(val, bitlen);
+            pool->wires_.emplace(key, s->get_wires());
+            return s;
+        }
+        
+    private:
+        static constant_pool*& current_(){
+            static thread_local constant_pool* current = nullptr;
+            return current;
+        }
+        
+        constant_pool* previous_;
+        std::map<std::tuple<ABYCircuit*, uint64_t, uint32_t>, std::vector<uint32_t>> wires_;
+    };
+    
+    
+    //While it is the innermost graph of the calling thread, the operators of
+    //faby record their gates in it instead of putting them into the circuit.
+    //A gate that was already recorded with the same operands is not recorded
+    //again, but the share of the first one is reused (common subexpression
+    //elimination). The gates are only put once a share depending on them is
+    //needed as an ABY share, e.g. by an output, a conversion or a wire
+    //operation, and then in the order they were recorded, so gates whose
+    //results are never needed are never put at all. Inputs, conversions and
+    //wire operations are still put right away. Like a constant pool, a graph
+    //must not span more than one execution.
+    class expression_graph{
+    public:
+        enum struct op : uint8_t{
+            leaf, constant, and_gate, xor_gate, or_gate, add_gate, sub_gate, mul_gate, gt_gate, mux_gate,
+            //selects one of two constants bit by bit, see put_constant_select
+            constant_select
+        };
+        
+        struct node{
+            ABYCircuit* circ;
+            op kind;
+            bool has_bits;
+            //mux: if true, if false, condition; constant select: condition
+            node* operands[3];
+            //the operands are narrowed to these maximum values
+            uint64_t operand_max_vals[3];
+            //constant: value; constant select: values if true and if false
+            uint64_t values[2];
+            uint32_t bitlen;
+            uint64_t max_val;
+            //see set_scope
+            uint32_t scope;
+            std::size_t id;
+            bool lowered;
+            std::vector<uint32_t> wires;
+        };
+        
+        struct operand{
+            node* n;
+            uint64_t max_val;
+        };
+        
+        //called with the scope of the gates put while lowering
+        using scope_observer = void(*)(uint32_t);
+        
+        expression_graph()
+        : previous_(current_()){
+            current_() = this;
+        }
+        
+        expression_graph(expression_graph const&) = delete;
+        expression_graph& operator=(expression_graph const&) = delete;
+        
+        ~expression_graph(){
+            current_() = previous_;
+        }
+        
+        static expression_graph* current(){
+            return current_();
+        }
+        
+        //the scope, e.g. the stage of a circuit_report, recorded with the
+        //gates from now on; returns the previous one
+        static uint32_t set_scope(uint32_t const scope){
+            uint32_t const previous = scope_();
+            scope_() = scope;
+            return previous;
+        }
+        
+        //observer is told the scope of each gate before it is put, and the
+        //scope from before afterwards; returns the previous observer
+        static scope_observer observe_scopes(scope_observer const observer){
+            scope_observer const previous = observer_();
+            observer_() = observer;
+            return previous;
+        }
+        
+        //a share already put into circ
+        node* leaf(ABYCircuit* const circ, std::vector<uint32_t> const& wires){
+            std::vector<uint64_t> key{uint64_t(op::leaf), reinterpret_cast<uintptr_t>(circ)};
+            key.insert(key.end(), wires.begin(), wires.end());
+            node* const n = find_or_add_(std::move(key), circ, op::leaf, false, {}, 0, 0, 0, 0);
+            if(!n->lowered){
+                n->wires = wires;
+                n->lowered = true;
+            }
+            return n;
+        }
+        
+        node* record(
+            ABYCircuit* const circ,
+            op const kind,
+            bool const has_bits,
+            std::initializer_list<operand> const operands,
+            uint64_t const max_val,
+            uint64_t const value_if_true = 0,
+            uint64_t const value_if_false = 0,
+            uint32_t const bitlen = 0
+        ){
+            std::vector<operand> ops(operands);
+            if(is_commutative_(kind)){
+                std::sort(ops.begin(), ops.end(), [](operand const& lhs, operand const& rhs){
+                    return std::make_tuple(lhs.n->id, lhs.max_val) < std::make_tuple(rhs.n->id, rhs.max_val);
+                });
+            }
+            std::vector<uint64_t> key{
+                uint64_t(kind), reinterpret_cast<uintptr_t>(circ), max_val, value_if_true, value_if_false, bitlen
+            };
+            for(operand const& o : ops){
+                key.emplace_back(o.n->id);
+                key.emplace_back(o.max_val);
+            }
+            return find_or_add_(std::move(key), circ, kind, has_bits, ops, max_val, value_if_true, value_if_false, bitlen);
+        }
+        
+        //puts the gates n depends on that are not put yet and returns the
+        //wires of n
+        static std::vector<uint32_t> const& lower(node* const n){
+            if(n->lowered){
+                return n->wires;
+            }
+            std::vector<node*> pending;
+            std::set<node*> seen;
+            std::vector<node*> stack{n};
+            while(!stack.empty()){
+                node* const m = stack.back();
+                stack.pop_back();
+                if(m->lowered || !seen.insert(m).second){
+                    continue;
+                }
+                pending.emplace_back(m);
+                for(node* const o : m->operands){
+                    if(o != nullptr){
+                        stack.emplace_back(o);
+                    }
+                }
+            }
+            //operands are always recorded before the gates using them
+            std::sort(pending.begin(), pending.end(), [](node const* lhs, node const* rhs){
+                return lhs->id < rhs->id;
+            });
+            scope_observer const observer = observer_();
+            uint32_t const scope = scope_();
+            for(node* const m : pending){
+                if(observer != nullptr){
+                    observer(m->scope);
+                }
+                lower_(*m);
+            }
+            if(observer != nullptr){
+                observer(scope);
+            }
+            return n->wires;
+        }
+        
+        static share* put_gate(ABYCircuit* const circ, op const kind, share* const a, share* const b, share* const c = nullptr){
+            switch(kind){
+            case op::and_gate: return circ->PutANDGate(a, b);
+            case op::xor_gate: return circ->PutXORGate(a, b);
+            case op::or_gate: return circ->PutORGate(a, b);
+            case op::add_gate: return circ->PutADDGate(a, b);
+            case op::sub_gate: return circ->PutSUBGate(a, b);
+            case op::mul_gate: return circ->PutMULGate(a, b);
+            case op::gt_gate: return circ->PutGTGate(a, b);
+            case op::mux_gate: return circ->PutMUXGate(a, b, c);
+            default: break;
+            }
+            assert(false);
+            return nullptr;
+        }
+        
+        //Every bit of the result is either a constant, the condition bit or
+        //its negation, so selecting between two constants of a boolean
+        //circuit needs no AND gates.
+        static share* put_constant_select(
+            ABYCircuit* const circ,
+            share* const condition,
+            uint64_t const if_true,
+            uint64_t const if_false,
+            uint32_t const bitlen
+        ){
+            auto wire_of = [&](share* const s){
+                share_arena::track(s);
+                return s->get_wire_id(0);
+            };
+            uint32_t const cond = condition->get_wire_id(0);
+            uint32_t const one = wire_of(constant_pool::put_constant(circ, 1u, 1u));
+            uint32_t zero = 0, not_cond = 0;
+            bool has_zero = false, has_not_cond = false;
+            std::vector<uint32_t> wires;
+            wires.reserve(bitlen);
+            for(uint32_t i = 0; i < bitlen; ++i){
+                bool const t = (if_true >> i) & 1u, f = (if_false >> i) & 1u;
+                if(t == f && !t && !has_zero){
+                    zero = wire_of(constant_pool::put_constant(circ, 0u, 1u));
+                    has_zero = true;
+                }
+                if(t != f && !t && !has_not_cond){
+                    share* const one_share = create_new_share(std::vector<uint32_t>{one}, circ);
+                    share_arena::track(one_share);
+                    not_cond = wire_of(circ->PutXORGate(condition, one_share));
+                    has_not_cond = true;
+                }
+                wires.emplace_back(t == f ? (t ? one : zero) : (t ? cond : not_cond));
+            }
+            return create_new_share(std::move(wires), circ);
+        }
+        
+    private:
+        static expression_graph*& current_(){
+            static thread_local expression_graph* current = nullptr;
+            return current;
+        }
+        
+        static uint32_t& scope_(){
+            static thread_local uint32_t scope = 0;
+            return scope;
+        }
+        
+        static scope_observer& observer_(){
+            static thread_local scope_observer observer = nullptr;
+            return observer;
+        }
+        
+        static bool is_commutative_(op const kind){
+            return kind == op::and_gate || kind == op::xor_gate || kind == op::or_gate
+                || kind == op::add_gate || kind == op::mul_gate;
+        }
+        
+        node* find_or_add_(
+            std::vector<uint64_t> key,
+            ABYCircuit* const circ,
+            op const kind,
+            bool const has_bits,
+            std::vector<operand> const& ops,
+            uint64_t const max_val,
+            uint64_t const value_if_true,
+            uint64_t const value_if_false,
+            uint32_t const bitlen
+        ){
+            auto const it = nodes_by_key_.find(key);
+            if(it != nodes_by_key_.end()){
+                return it->second;
+            }
+            nodes_.emplace_back();
+            node& n = nodes_.back();
+            n.circ = circ;
+            n.kind = kind;
+            n.has_bits = has_bits;
+            for(std::size_t i = 0; i < 3; ++i){
+                n.operands[i] = i < ops.size() ? ops[i].n : nullptr;
+                n.operand_max_vals[i] = i < ops.size() ? ops[i].max_val : 0;
+            }
+            n.values[0] = value_if_true;
+            n.values[1] = value_if_false;
+            n.bitlen = bitlen;
+            n.max_val = max_val;
+            n.scope = scope_();
+            n.id = nodes_.size() - 1;
+            n.lowered = false;
+            nodes_by_key_.emplace(std::move(key), &n);
+            return &n;
+        }
+        
+        //a new share of the wires of n, narrowed to max_val
+        static share* operand_share_(node const& n, uint64_t const max_val){
+            share* const s = create_new_share(n.wires, n.circ);
+            share_arena::track(s);
+            if(n.has_bits){
+                s->set_bitlength(std::min(bitlen_of_max_val(max_val), s->get_bitlength()));
+            }
+            return s;
+        }
+        
+        static void lower_(node& n){
+            share* operands[3] = {nullptr, nullptr, nullptr};
+            for(std::size_t i = 0; i < 3; ++i){
+                if(n.operands[i] != nullptr){
+                    operands[i] = operand_share_(*n.operands[i], n.operand_max_vals[i]);
+                }
+            }
+            share* s = nullptr;
+            switch(n.kind){
+            case op::constant:
+                s = constant_pool::put_constant(n.circ, n.values[0], n.bitlen);
+                break;
+            case op::constant_select:
+                s = put_constant_select(n.circ, operands[0], n.values[0], n.values[1], n.bitlen);
+                break;
+            default:
+                s = put_gate(n.circ, n.kind, operands[0], operands[1], operands[2]);
+                break;
+            }
+            share_arena::track(s);
+            if(n.has_bits){
+                s->set_bitlength(std::min(bitlen_of_max_val(n.max_val), s->get_max_bitlength()));
+                share_census::count_width(s->get_bitlength());
+            }
+            n.wires = s->get_wires();
+            n.lowered = true;
+        }
+        
+        expression_graph* previous_;
+        //a deque, as the nodes are referred to by their address
+        std::deque<node> nodes_;
+        std::map<std::vector<uint64_t>, node*> nodes_by_key_;
+    };
+    
     
     class YaoCircuit{
     public:
@@ -286,12 +773,34 @@ namespace faby{
     };
     
     
+    //tags the construction of a share known to hold a constant
+    struct constant_tag{};
+    
     template<typename CircuitType>
     struct basic_functional_share{
     private:
-        share* s;
-        uint64_t max_val;
-        static CircuitType circuit;
+        //put lazily for shares of a gate recorded in an expression_graph
+        mutable share* s = nullptr;
+        expression_graph::node* node_ = nullptr;
+        uint64_t max_val = 0;
+        //constants are known in clear while the circuit is built, which
+        //allows the operators to fold them
+        bool is_constant_ = false;
+        uint64_t constant_ = 0;
+        uint32_t constant_bitlen_ = 0;
+        //circuit of the innermost faby_context of the calling thread
+        static thread_local CircuitType circuit;
+        
+        share* share_() const{
+            if(s == nullptr && node_ != nullptr){
+                s = create_new_share(expression_graph::lower(node_), node_->circ);
+                share_arena::track(s);
+                if(CircuitType::has_bits){
+                    s->set_bitlength(std::min(bitlen_of_max_val(max_val), s->get_bitlength()));
+                }
+            }
+            return s;
+        }
         
     public:
         using circuit_t = CircuitType;
@@ -302,53 +811,91 @@ namespace faby{
         basic_functional_share& operator=(basic_functional_share&&) = default;
         
         basic_functional_share(share* sh)
-        : s(sh), max_val(max_val_of_bitlen(sh->get_bitlength())){}
+        : s(sh), max_val(max_val_of_bitlen(sh->get_bitlength())){
+            share_arena::track(s);
+        }
         
         basic_functional_share(share* sh, uint64_t max_v)
         : s(sh), max_val(max_v){
+            share_arena::track(s);
             if(CircuitType::has_bits){
                 s->set_bitlength(std::min(bitlen_of_max_val(max_val), s->get_max_bitlength()));
+                share_census::count_width(s->get_bitlength());
+            }
+        }
+        
+        //the result of a gate recorded in an expression_graph
+        basic_functional_share(expression_graph::node* n, uint64_t max_v)
+        : node_(n), max_val(max_v){}
+        
+        template<typename Share>
+        basic_functional_share(Share sh, uint64_t max_v, constant_tag, uint64_t value, uint32_t bitlen)
+        : basic_functional_share(sh, max_v){
+            is_constant_ = true;
+            constant_ = value;
+            constant_bitlen_ = bitlen;
+        }
+        
+        bool is_constant() const{
+            return is_constant_;
+        }
+        
+        uint64_t constant_value() const{
+            return constant_;
+        }
+        
+        //the width of the constant gate, boolean shares may be narrower
+        uint32_t constant_bitlen() const{
+            return CircuitType::has_bits ? std::min(bitlen_of_max_val(max_val), constant_bitlen_) : constant_bitlen_;
+        }
+        
+        //whether both are known to be the same share, without putting gates
+        bool same_as(basic_functional_share const& rhs) const{
+            return node_ != nullptr ? node_ == rhs.node_ : rhs.node_ == nullptr && s == rhs.s;
+        }
+        
+        //refers to the gate of the share in the current expression_graph
+        expression_graph::operand operand() const{
+            if(node_ != nullptr){
+                return {node_, max_val};
             }
+            return {expression_graph::current()->leaf(get_circuit(), s->get_wires()), max_val};
         }
         
         operator share*(){
-            return s;
+            return share_();
         }
         
         operator share const*() const{
-            return s;
+            return share_();
         }
         
         share& operator*(){
-            return *s;
+            return *share_();
         }
         
         share const& operator*() const{
-            return *s;
+            return *share_();
         }
         
         share* operator->(){
-            return s;
+            return share_();
         }
         
         share const* operator->() const{
-            return s;
+            return share_();
         }
         
         basic_functional_share operator[](uint32_t idx) const{
-            return basic_functional_share(s->get_wire_ids_as_share(idx), 1);
+            return basic_functional_share(share_()->get_wire_ids_as_share(idx), 1);
         }
         
         uint64_t get_max_val() const {
             return max_val;
         }
         
-        share* get_share() {
-            return *this;
-        }
-        
-        share const* get_share() const {
-            return *this;
+        share* get_share() const {
+            return share_();
         }
         
         static ABYCircuit* get_circuit(){
@@ -359,7 +906,7 @@ namespace faby{
     };
     
     template<typename CircuitType>
-    CircuitType basic_functional_share<CircuitType>::circuit;
+    thread_local CircuitType basic_functional_share<CircuitType>::circuit;
     
     template<typename>
     struct functional_share;
@@ -378,13 +925,17 @@ namespace faby{
                 , gmw_::get_circuit()
             )
             , rhs.get_max_val()
-        ){}
+        ){
+            share_census::count_conversion("y2a");
+        }
         
         explicit functional_share(gmw_ rhs)
         : base_(
             base_::get_circuit()->PutB2AGate(expand_share(rhs.get_share(), gmw_::get_circuit())) 
             , rhs.get_max_val()
-        ){}
+        ){
+            share_census::count_conversion("b2a");
+        }
         
     private:
         static share* expand_share(share* s, Circuit* circ){
@@ -407,10 +958,14 @@ namespace faby{
         using base_::base_;
         
         explicit functional_share(arith_ rhs)
-        : base_(base_::get_circuit()->PutA2YGate(rhs.get_share()), rhs.get_max_val()){}
+        : base_(base_::get_circuit()->PutA2YGate(rhs.get_share()), rhs.get_max_val()){
+            share_census::count_conversion("a2y");
+        }
         
         explicit functional_share(gmw_ rhs)
-        : base_(base_::get_circuit()->PutB2YGate(rhs.get_share()), rhs.get_max_val()){}
+        : base_(base_::get_circuit()->PutB2YGate(rhs.get_share()), rhs.get_max_val()){
+            share_census::count_conversion("b2y");
+        }
     };
     
     template<>
@@ -421,17 +976,22 @@ namespace faby{
         using base_::base_;
         
         explicit functional_share(arith_ rhs)
-        : base_(base_::get_circuit()->PutA2BGate(rhs.get_share(), yao_::get_circuit()), rhs.get_max_val()){}
+        : base_(base_::get_circuit()->PutA2BGate(rhs.get_share(), yao_::get_circuit()), rhs.get_max_val()){
+            share_census::count_conversion("a2b");
+        }
         
         explicit functional_share(yao_ rhs)
-        : base_(base_::get_circuit()->PutY2BGate(rhs.get_share()), rhs.get_max_val()){}
+        : base_(base_::get_circuit()->PutY2BGate(rhs.get_share()), rhs.get_max_val()){
+            share_census::count_conversion("y2b");
+        }
     };
     
     template<typename CircuitType>
     struct input_t{
-        functional_share<CircuitType> operator()(uint32_t val, uint32_t bitlen, e_role role, uint64_t max_val) const{
+        functional_share<CircuitType> operator()(uint64_t val, uint32_t bitlen, e_role role, uint64_t max_val) const{
             using fs = functional_share<CircuitType>;
             assert(fs::get_circuit() != nullptr);
+            share_census::count_input(bitlen);
             return fs(fs::get_circuit()->PutINGate(val, bitlen, role), max_val);
         }
         
@@ -445,7 +1005,13 @@ namespace faby{
         functional_share<CircuitType> operator()(uint64_t val, uint32_t bitlen, uint64_t max_val) const{
             using fs = functional_share<CircuitType>;
             assert(fs::get_circuit() != nullptr);
-            return fs(fs::get_circuit()->PutCONSGate(val, bitlen), max_val);
+            if(expression_graph* const graph = expression_graph::current()){
+                return fs(
+                    graph->record(fs::get_circuit(), expression_graph::op::constant, CircuitType::has_bits, {}, max_val, val, 0, bitlen),
+                    max_val, constant_tag{}, val, bitlen
+                );
+            }
+            return fs(constant_pool::put_constant(fs::get_circuit(), val, bitlen), max_val, constant_tag{}, val, bitlen);
         }
         functional_share<CircuitType> operator()(uint64_t val, uint32_t bitlen) const{
             return (*this)(val, bitlen, max_val_of_bitlen(bitlen));
@@ -460,6 +1026,7 @@ namespace faby{
         functional_share<CircuitType> operator()(uint64_t val, uint32_t bitlen, uint64_t max_val) const{
             using fs = functional_share<CircuitType>;
             assert(fs::get_circuit() != nullptr);
+            share_census::count_input(bitlen);
             return fs(fs::get_circuit()->PutSharedINGate(val, bitlen), max_val);
         }
         functional_share<CircuitType> operator()(uint64_t val, uint32_t bitlen) const{
@@ -475,6 +1042,7 @@ namespace faby{
         functional_share<CircuitType> operator()(uint32_t bitlen, uint64_t max_val) const{
             using fs = functional_share<CircuitType>;
             assert(fs::get_circuit() != nullptr);
+            share_census::count_input(bitlen);
             return fs(fs::get_circuit()->PutDummyINGate(bitlen), max_val);
         }
         functional_share<CircuitType> operator()(uint32_t bitlen) const{
@@ -482,12 +1050,18 @@ namespace faby{
         }
     };
     
+    template<typename CircuitType>
+    inline functional_share<CircuitType> put_output(functional_share<CircuitType> s, e_role role){
+        using fs = functional_share<CircuitType>;
+        assert(fs::get_circuit() != nullptr);
+        return fs(fs::get_circuit()->PutOUTGate(s, role), s.get_max_val());
+    }
+    
+    //dispatches to put_output, which circuits without ABY gates overload
     struct output_t{
         template<typename CircuitType>
         functional_share<CircuitType> operator()(functional_share<CircuitType> s, e_role role = ALL) const{
-            using fs = functional_share<CircuitType>;
-            assert(fs::get_circuit() != nullptr);
-            return fs(fs::get_circuit()->PutOUTGate(s, role), s.get_max_val());
+            return put_output(s, role);
         }
     };
     
@@ -550,34 +1124,77 @@ namespace faby{
         return biggest | set_all_bits(smallest & biggest);
     }
     
+    //the result of an operation on constants, which needs no gates but a
+    //constant; arithmetic constants keep the width of the operand like
+    template<typename CircuitType>
+    inline functional_share<CircuitType> fold(uint64_t val, uint64_t max_val, functional_share<CircuitType> const& like){
+        uint32_t const bitlen = CircuitType::has_bits ? bitlen_of_max_val(max_val) : like.constant_bitlen();
+        return cons_input<CircuitType>(val & max_val_of_bitlen(bitlen), bitlen, max_val);
+    }
+    
+    template<typename CircuitType>
+    inline bool is_zero(functional_share<CircuitType> const& s){
+        return s.is_constant() && s.constant_value() == 0;
+    }
+    
+    //puts the gate kind, or records it in the current expression_graph
+    template<typename CircuitType>
+    inline functional_share<CircuitType> put_gate(
+        expression_graph::op kind,
+        uint64_t max_val,
+        functional_share<CircuitType> const& a,
+        functional_share<CircuitType> const& b
+    ){
+        using fs = functional_share<CircuitType>;
+        if(expression_graph* const graph = expression_graph::current()){
+            return fs(graph->record(fs::get_circuit(), kind, CircuitType::has_bits, {a.operand(), b.operand()}, max_val), max_val);
+        }
+        return fs(expression_graph::put_gate(fs::get_circuit(), kind, a.get_share(), b.get_share()), max_val);
+    }
+    
     template<typename CircuitType>
     inline functional_share<CircuitType> operator&(functional_share<CircuitType> lhs, functional_share<CircuitType> rhs){
         using fs = functional_share<CircuitType>;
         assert(fs::get_circuit() != nullptr);
-        return fs(fs::get_circuit()->PutANDGate(lhs, rhs), max_val_of_and(lhs.get_max_val(), rhs.get_max_val()));
+        uint64_t const max_val = max_val_of_and(lhs.get_max_val(), rhs.get_max_val());
+        if(lhs.is_constant() && rhs.is_constant()){
+            return fold(lhs.constant_value() & rhs.constant_value(), max_val, lhs);
+        }
+        if(is_zero(lhs)){
+            return lhs;
+        }
+        if(is_zero(rhs)){
+            return rhs;
+        }
+        return put_gate(expression_graph::op::and_gate, max_val, lhs, rhs);
     }
     
     template<typename CircuitType>
     inline functional_share<CircuitType> operator^(functional_share<CircuitType> lhs, functional_share<CircuitType> rhs){
         using fs = functional_share<CircuitType>;
-	//std::cout << "YAO: " << functional_share<YaoCircuit>::get_circuit() << std::endl; 
-	//std::cout << "GMW: " << functional_share<gmw_circuit>::get_circuit() << std::endl; 
-	//std::cout << "ARITHMETIC: " << functional_share<arithmetic_circuit>::get_circuit() << std::endl;
-//std::cout << "CircuitType: " << functional_share<CircuitType>::get_circuit() << std::endl;
-//std::cout << "fs: " << fs::get_circuit() << std::endl;
-//std::cout << decltype(fs::get_circuit())(nullptr) << std::endl;
-//std::cout << std::boolalpha << (fs::get_circuit() != nullptr) << 
-//std::endl;
-
-      assert(fs::get_circuit() != nullptr);
-        return fs(fs::get_circuit()->PutXORGate(lhs, rhs), max_val_of_xor(lhs.get_max_val(), rhs.get_max_val()));
+        assert(fs::get_circuit() != nullptr);
+        uint64_t const max_val = max_val_of_xor(lhs.get_max_val(), rhs.get_max_val());
+        if(lhs.is_constant() && rhs.is_constant()){
+            return fold(lhs.constant_value() ^ rhs.constant_value(), max_val, lhs);
+        }
+        return put_gate(expression_graph::op::xor_gate, max_val, lhs, rhs);
     }
     
     template<typename CircuitType>
     inline functional_share<CircuitType> operator|(functional_share<CircuitType> lhs, functional_share<CircuitType> rhs){
         using fs = functional_share<CircuitType>;
         assert(fs::get_circuit() != nullptr);
-        return fs(fs::get_circuit()->PutORGate(lhs, rhs), max_val_of_or(lhs.get_max_val(), rhs.get_max_val()));
+        uint64_t const max_val = max_val_of_or(lhs.get_max_val(), rhs.get_max_val());
+        if(lhs.is_constant() && rhs.is_constant()){
+            return fold(lhs.constant_value() | rhs.constant_value(), max_val, lhs);
+        }
+        if(is_zero(lhs)){
+            return rhs;
+        }
+        if(is_zero(rhs)){
+            return lhs;
+        }
+        return put_gate(expression_graph::op::or_gate, max_val, lhs, rhs);
     }
     
     constexpr uint64_t max_val_plus(uint64_t lhs_max_val, uint64_t rhs_max_val){
@@ -593,7 +1210,11 @@ namespace faby{
     inline functional_share<CircuitType> operator+(functional_share<CircuitType> lhs, functional_share<CircuitType> rhs){
         using fs = functional_share<CircuitType>;
         assert(fs::get_circuit() != nullptr);
-        return fs(fs::get_circuit()->PutADDGate(lhs, rhs), max_val_plus(lhs.get_max_val(), rhs.get_max_val()));
+        uint64_t const max_val = max_val_plus(lhs.get_max_val(), rhs.get_max_val());
+        if(lhs.is_constant() && rhs.is_constant()){
+            return fold(lhs.constant_value() + rhs.constant_value(), max_val, lhs);
+        }
+        return put_gate(expression_graph::op::add_gate, max_val, lhs, rhs);
     }
     
     constexpr uint64_t max_val_sub(uint64_t lhs_max_val, uint64_t rhs_max_val){
@@ -604,7 +1225,19 @@ namespace faby{
     inline functional_share<CircuitType> operator-(functional_share<CircuitType> lhs, functional_share<CircuitType> rhs){
         using fs = functional_share<CircuitType>;
         assert(fs::get_circuit() != nullptr);
-        return fs(fs::get_circuit()->PutSUBGate(lhs, rhs), max_val_sub(lhs.get_max_val(), rhs.get_max_val()));
+        uint64_t const max_val = max_val_sub(lhs.get_max_val(), rhs.get_max_val());
+        if(lhs.is_constant() && rhs.is_constant()){
+            //wraps around like the gate at the width of lhs
+            return fold(
+                (lhs.constant_value() - rhs.constant_value()) & max_val_of_bitlen(lhs.constant_bitlen()),
+                max_val,
+                lhs
+            );
+        }
+        if(is_zero(rhs)){
+            return lhs;
+        }
+        return put_gate(expression_graph::op::sub_gate, max_val, lhs, rhs);
     }
     
     constexpr uint64_t max_val_mul(uint64_t lhs_max_val, uint64_t rhs_max_val){
@@ -621,12 +1254,22 @@ namespace faby{
     inline functional_share<CircuitType> operator*(functional_share<CircuitType> lhs, functional_share<CircuitType> rhs){
         using fs = functional_share<CircuitType>;
         assert(fs::get_circuit() != nullptr);
-        return fs(fs::get_circuit()->PutMULGate(lhs, rhs), max_val_mul(lhs.get_max_val(), rhs.get_max_val()));
+        uint64_t const max_val = max_val_mul(lhs.get_max_val(), rhs.get_max_val());
+        if(lhs.is_constant() && rhs.is_constant()){
+            return fold(lhs.constant_value() * rhs.constant_value(), max_val, lhs);
+        }
+        if(is_zero(lhs)){
+            return lhs;
+        }
+        if(is_zero(rhs)){
+            return rhs;
+        }
+        return put_gate(expression_graph::op::mul_gate, max_val, lhs, rhs);
     }
     
     template<typename CircuitType>
     inline functional_share<CircuitType> operator!(functional_share<CircuitType> bit){
-        assert(bit->get_bitlength() == 1);
+        assert(bit.get_max_val() <= 1);
         return bit ^ cons_input<CircuitType>(1u, 1u);
     }
     
@@ -634,7 +1277,10 @@ namespace faby{
     inline functional_share<CircuitType> operator>(functional_share<CircuitType> lhs, functional_share<CircuitType> rhs){
         using fs = functional_share<CircuitType>;
         assert(fs::get_circuit() != nullptr);
-        return fs(fs::get_circuit()->PutGTGate(lhs, rhs), 1);
+        if(lhs.is_constant() && rhs.is_constant()){
+            return fold(uint64_t(lhs.constant_value() > rhs.constant_value()), 1, lhs);
+        }
+        return put_gate(expression_graph::op::gt_gate, 1, lhs, rhs);
     }
     
     template<typename CircuitType>
@@ -659,9 +1305,36 @@ namespace faby{
         functional_share<CircuitType> if_false
     ){
         using fs = functional_share<CircuitType>;
+        using op = expression_graph::op;
         assert(fs::get_circuit() != nullptr);
-        return fs(fs::get_circuit()->PutMUXGate(
-            if_true, if_false, condition), std::max(if_true.get_max_val(), if_false.get_max_val())
+        uint64_t const max_val = std::max(if_true.get_max_val(), if_false.get_max_val());
+        if(condition.is_constant()){
+            return condition.constant_value() ? if_true : if_false;
+        }
+        if(if_true.same_as(if_false)){
+            return if_true;
+        }
+        expression_graph* const graph = expression_graph::current();
+        if(CircuitType::has_bits && if_true.is_constant() && if_false.is_constant() && condition.get_max_val() <= 1){
+            uint32_t const bitlen = bitlen_of_max_val(max_val);
+            uint64_t const t = if_true.constant_value(), f = if_false.constant_value();
+            if(graph != nullptr){
+                return fs(graph->record(fs::get_circuit(), op::constant_select, true, {condition.operand()}, max_val, t, f, bitlen), max_val);
+            }
+            return fs(expression_graph::put_constant_select(fs::get_circuit(), condition.get_share(), t, f, bitlen), max_val);
+        }
+        if(graph != nullptr){
+            return fs(
+                graph->record(
+                    fs::get_circuit(), op::mux_gate, CircuitType::has_bits,
+                    {if_true.operand(), if_false.operand(), condition.operand()}, max_val
+                ),
+                max_val
+            );
+        }
+        return fs(
+            expression_graph::put_gate(fs::get_circuit(), op::mux_gate, if_true.get_share(), if_false.get_share(), condition.get_share()),
+            max_val
         );
     }
     
@@ -671,11 +1344,18 @@ namespace faby{
     template<typename C>
     faby_context<C> create_faby_context(ABYCircuit*);
     
+    //Contexts form a stack per thread: creating a context makes its circuit
+    //the one the shares of the calling thread are built in until the context
+    //is destroyed, which restores the circuit of the enclosing context.
+    //Threads build their circuits independently of each other, so shares must
+    //not be passed to other threads while they are built upon.
     template<typename CircuitType>
     struct faby_context{
     private:
         bool owner_ = false;
-        faby_context(ABYCircuit* circuit){
+        CircuitType previous_;
+        faby_context(ABYCircuit* circuit)
+        : previous_(functional_share<CircuitType>::circuit){
             owner_ = true;
             functional_share<CircuitType>::circuit = circuit;
         }
@@ -683,20 +1363,21 @@ namespace faby{
         faby_context() = default;
         faby_context(faby_context const&) = delete;
         faby_context(faby_context&& rhs)
-        : owner_(rhs.owner_){
+        : owner_(rhs.owner_), previous_(rhs.previous_){
             rhs.owner_ = false;
         }
         faby_context& operator=(faby_context const&) = delete;
         faby_context& operator=(faby_context&& rhs){
             if(&rhs != this){
                 owner_ = rhs.owner_;
+                previous_ = rhs.previous_;
                 rhs.owner_ = false;
             }
             return *this;
         }
         ~faby_context(){
             if(owner_){
-                functional_share<CircuitType>::circuit = nullptr;
+                functional_share<CircuitType>::circuit = previous_;
             }
         }
         
@@ -709,12 +1390,7 @@ namespace faby{
     
     template<typename C>
     faby_context<C> create_faby_context(ABYCircuit* circuit){
-        if(functional_share<C>::get_circuit() != nullptr){
-            throw std::logic_error("context already in use (destroy old context before creating a new one");
-        }
-        else{
-            return faby_context<C>(circuit);
-        }
+        return faby_context<C>(circuit);
     }
     
     inline faby_context<YaoCircuit> create_yao_context(ABYCircuit* circ){
@@ -732,29 +1408,29 @@ namespace faby{
     template<typename CircuitType>
     functional_share<CircuitType> concat(functional_share<CircuitType> lhs, functional_share<CircuitType> rhs){
         using fs = functional_share<CircuitType>;
-        std::vector<uint32_t> result_wires(rhs->get_wires());
+        std::vector<uint32_t> const& rhs_wires(rhs->get_wires());
         std::vector<uint32_t> const& lhs_wires(lhs->get_wires());
-        result_wires.reserve(result_wires.size() + lhs_wires.size());
-        for(auto const& wire : lhs_wires){
-            result_wires.push_back(wire);
-        }
+        std::vector<uint32_t> result_wires;
+        result_wires.reserve(rhs_wires.size() + lhs_wires.size());
+        result_wires.insert(result_wires.end(), rhs_wires.begin(), rhs_wires.end());
+        result_wires.insert(result_wires.end(), lhs_wires.begin(), lhs_wires.end());
+        //the wires are moved into the new share instead of copied once more
         return fs(
-            create_new_share(result_wires, fs::get_circuit()), 
+            create_new_share(std::move(result_wires), fs::get_circuit()), 
             (lhs.get_max_val() << rhs->get_bitlength()) | rhs.get_max_val()
         );
     }
     template<typename CircuitType>
     functional_share<CircuitType> expand(functional_share<CircuitType> to_expand, std::size_t new_size){
         using fs = functional_share<CircuitType>;
-        std::vector<uint32_t> result_wires(to_expand->get_wires());
-        uint32_t wire = result_wires.back();
-        std::size_t old_size = result_wires.size();
+        std::vector<uint32_t> const& wires(to_expand->get_wires());
+        std::size_t old_size = wires.size();
+        std::vector<uint32_t> result_wires;
         result_wires.reserve(new_size);
-        for(int i = 0; i < new_size - old_size; ++i){
-            result_wires.emplace_back(wire);
-        }
+        result_wires.insert(result_wires.end(), wires.begin(), wires.end());
+        result_wires.resize(new_size, wires.back());
         return fs(
-            create_new_share(result_wires, fs::get_circuit()),
+            create_new_share(std::move(result_wires), fs::get_circuit()),
             (max_val_of_bitlen(new_size - old_size) << old_size) | to_expand.get_max_val()
         );
     }
@@ -0,0 +1,368 @@
+/**
+ \file 		faby_plain.h
+ \author	oliver.schick92@gmail.com
+ \copyright	ABY - A Framework for Efficient Mixed-protocol Secure Two-party Computation
+ Copyright (C) 2019 Engineering Cryptographic Protocols Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+            it under the terms of the GNU Lesser General Public License as published
+            by the Free Software Foundation, either version 3 of the License, or
+            (at your option) any later version.
+            ABY is distributed in the hope that it will be useful,
+            but WITHOUT ANY WARRANTY; without even the implied warranty of
+            MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+            GNU Lesser General Public License for more details.
+            You should have received a copy of the GNU Lesser General Public License
+            along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ABY_SEC_DOODLE_FABY_PLAIN_H_19102026_1710
+#define ABY_SEC_DOODLE_FABY_PLAIN_H_19102026_1710
+
+#include "faby.h"
+
+namespace faby{
+
+    //Evaluates the faby operations on cleartext values instead of putting
+    //gates, so circuits can be checked without a second party. While it is
+    //the innermost plain_circuit of the calling thread, it counts the gates
+    //and the AND depth the operations would take in an ABY boolean circuit,
+    //using the size optimized constructions and the constant folding of faby.
+    //Gates an expression_graph would share or never put are counted anyway.
+    class plain_circuit{
+    public:
+        static constexpr bool has_bits = true;
+
+        plain_circuit()
+        : previous_(current_()){
+            current_() = this;
+        }
+
+        plain_circuit(plain_circuit const&) = delete;
+        plain_circuit& operator=(plain_circuit const&) = delete;
+
+        ~plain_circuit(){
+            current_() = previous_;
+        }
+
+        uint64_t num_and_gates() const{
+            return and_gates_;
+        }
+
+        uint64_t num_xor_gates() const{
+            return xor_gates_;
+        }
+
+        uint64_t num_input_bits() const{
+            return input_bits_;
+        }
+
+        uint64_t num_outputs() const{
+            return outputs_;
+        }
+
+        //AND depth of the deepest output
+        uint32_t depth() const{
+            return depth_;
+        }
+
+        static void count_gates(uint64_t and_gates, uint64_t xor_gates){
+            if(plain_circuit* const circ = current_()){
+                circ->and_gates_ += and_gates;
+                circ->xor_gates_ += xor_gates;
+            }
+        }
+
+        static void count_input(uint32_t bitlen){
+            if(plain_circuit* const circ = current_()){
+                circ->input_bits_ += bitlen;
+            }
+        }
+
+        static void count_output(uint32_t depth){
+            if(plain_circuit* const circ = current_()){
+                ++circ->outputs_;
+                circ->depth_ = std::max(circ->depth_, depth);
+            }
+        }
+
+    private:
+        static plain_circuit*& current_(){
+            static thread_local plain_circuit* current = nullptr;
+            return current;
+        }
+
+        plain_circuit* previous_;
+        uint64_t and_gates_ = 0;
+        uint64_t xor_gates_ = 0;
+        uint64_t input_bits_ = 0;
+        uint64_t outputs_ = 0;
+        uint32_t depth_ = 0;
+    };
+
+    //holds the cleartext value of a share, narrowed to the bits of max_val
+    //like the shares of the other circuits
+    template<>
+    struct functional_share<plain_circuit>{
+    private:
+        uint64_t value_ = 0;
+        uint64_t max_val_ = 0;
+        uint32_t bitlen_ = 1;
+        uint32_t depth_ = 0;
+        bool is_constant_ = false;
+
+    public:
+        using circuit_t = plain_circuit;
+        functional_share() = default;
+
+        functional_share(uint64_t value, uint32_t bitlen, uint64_t max_val, uint32_t depth, bool is_constant = false)
+        : max_val_(max_val),
+          bitlen_(std::min<uint32_t>(bitlen, bitlen_of_max_val(max_val))),
+          depth_(depth),
+          is_constant_(is_constant){
+            value_ = value & max_val_of_bitlen(bitlen_);
+        }
+
+        bool is_constant() const{
+            return is_constant_;
+        }
+
+        uint64_t constant_value() const{
+            return value_;
+        }
+
+        template<typename T>
+        T get_clear_value() const{
+            return static_cast<T>(value_);
+        }
+
+        uint32_t get_bitlength() const{
+            return bitlen_;
+        }
+
+        uint64_t get_max_val() const{
+            return max_val_;
+        }
+
+        uint32_t depth() const{
+            return depth_;
+        }
+
+        //outputs are read like ABY shares, i.e. s->get_clear_value<T>()
+        functional_share const* operator->() const{
+            return this;
+        }
+
+        functional_share operator[](uint32_t idx) const{
+            return functional_share((value_ >> idx) & 1u, 1u, 1u, depth_, is_constant_);
+        }
+    };
+
+    using plain_share = functional_share<plain_circuit>;
+
+    template<>
+    struct input_t<plain_circuit>{
+        plain_share operator()(uint64_t val, uint32_t bitlen, e_role, uint64_t max_val) const{
+            plain_circuit::count_input(bitlen);
+            return plain_share(val, bitlen, max_val, 0);
+        }
+
+        plain_share operator()(uint64_t val, uint32_t bitlen, e_role role) const{
+            return (*this)(val, bitlen, role, max_val_of_bitlen(bitlen));
+        }
+    };
+
+    template<>
+    struct shared_input_t<plain_circuit>{
+        plain_share operator()(uint64_t val, uint32_t bitlen, uint64_t max_val) const{
+            plain_circuit::count_input(bitlen);
+            return plain_share(val, bitlen, max_val, 0);
+        }
+        plain_share operator()(uint64_t val, uint32_t bitlen) const{
+            return (*this)(val, bitlen, max_val_of_bitlen(bitlen));
+        }
+        plain_share operator()(uint64_t val) const{
+            return (*this)(val, bitlen_of_max_val(val), val);
+        }
+    };
+
+    template<>
+    struct cons_input_t<plain_circuit>{
+        plain_share operator()(uint64_t val, uint32_t bitlen, uint64_t max_val) const{
+            return plain_share(val, bitlen, max_val, 0, true);
+        }
+        plain_share operator()(uint64_t val, uint32_t bitlen) const{
+            return (*this)(val, bitlen, max_val_of_bitlen(bitlen));
+        }
+        plain_share operator()(uint64_t val) const{
+            return (*this)(val, bitlen_of_max_val(val), val);
+        }
+    };
+
+    constexpr input_t<plain_circuit> plain_input;
+    constexpr shared_input_t<plain_circuit> plain_shared_input;
+    constexpr cons_input_t<plain_circuit> plain_cons_input;
+
+    inline plain_share put_output(plain_share s, e_role){
+        plain_circuit::count_output(s.depth());
+        return s;
+    }
+
+    //result of a gate of and_gates AND gates and xor_gates XOR gates whose
+    //output is and_depth AND gates deeper than its deepest input
+    inline plain_share plain_gate(
+        uint64_t value,
+        uint64_t max_val,
+        uint32_t input_depth,
+        uint64_t and_gates,
+        uint64_t xor_gates,
+        uint32_t and_depth
+    ){
+        plain_circuit::count_gates(and_gates, xor_gates);
+        return plain_share(value, bitlen_of_max_val(max_val), max_val, input_depth + and_depth);
+    }
+
+    inline uint32_t plain_depth(plain_share const& lhs, plain_share const& rhs){
+        return std::max(lhs.depth(), rhs.depth());
+    }
+
+    inline plain_share operator&(plain_share lhs, plain_share rhs){
+        uint64_t const max_val = max_val_of_and(lhs.get_max_val(), rhs.get_max_val());
+        if(lhs.is_constant() && rhs.is_constant()){
+            return plain_cons_input(lhs.constant_value() & rhs.constant_value(), bitlen_of_max_val(max_val), max_val);
+        }
+        if(is_zero(lhs)){
+            return lhs;
+        }
+        if(is_zero(rhs)){
+            return rhs;
+        }
+        uint32_t const bitlen = std::max(lhs.get_bitlength(), rhs.get_bitlength());
+        return plain_gate(
+            lhs.get_clear_value<uint64_t>() & rhs.get_clear_value<uint64_t>(), max_val,
+            plain_depth(lhs, rhs), bitlen, 0, 1
+        );
+    }
+
+    inline plain_share operator^(plain_share lhs, plain_share rhs){
+        uint64_t const max_val = max_val_of_xor(lhs.get_max_val(), rhs.get_max_val());
+        uint64_t const value = lhs.get_clear_value<uint64_t>() ^ rhs.get_clear_value<uint64_t>();
+        if(lhs.is_constant() && rhs.is_constant()){
+            return plain_cons_input(value, bitlen_of_max_val(max_val), max_val);
+        }
+        uint32_t const bitlen = std::max(lhs.get_bitlength(), rhs.get_bitlength());
+        return plain_gate(value, max_val, plain_depth(lhs, rhs), 0, bitlen, 0);
+    }
+
+    inline plain_share operator|(plain_share lhs, plain_share rhs){
+        uint64_t const max_val = max_val_of_or(lhs.get_max_val(), rhs.get_max_val());
+        uint64_t const value = lhs.get_clear_value<uint64_t>() | rhs.get_clear_value<uint64_t>();
+        if(lhs.is_constant() && rhs.is_constant()){
+            return plain_cons_input(value, bitlen_of_max_val(max_val), max_val);
+        }
+        if(is_zero(lhs)){
+            return rhs;
+        }
+        if(is_zero(rhs)){
+            return lhs;
+        }
+        //a | b = a ^ b ^ (a & b)
+        uint32_t const bitlen = std::max(lhs.get_bitlength(), rhs.get_bitlength());
+        return plain_gate(value, max_val, plain_depth(lhs, rhs), bitlen, 2 * bitlen, 1);
+    }
+
+    inline plain_share operator+(plain_share lhs, plain_share rhs){
+        uint64_t const max_val = max_val_plus(lhs.get_max_val(), rhs.get_max_val());
+        uint64_t const value = lhs.get_clear_value<uint64_t>() + rhs.get_clear_value<uint64_t>();
+        if(lhs.is_constant() && rhs.is_constant()){
+            return plain_cons_input(value, bitlen_of_max_val(max_val), max_val);
+        }
+        //ripple carry adder, one AND gate and four XOR gates per bit
+        uint32_t const bitlen = std::max(lhs.get_bitlength(), rhs.get_bitlength());
+        return plain_gate(value, max_val, plain_depth(lhs, rhs), bitlen, 4 * bitlen, bitlen);
+    }
+
+    inline plain_share operator-(plain_share lhs, plain_share rhs){
+        uint64_t const max_val = max_val_sub(lhs.get_max_val(), rhs.get_max_val());
+        //wraps around like the gate at the width of lhs
+        uint64_t const value = (lhs.get_clear_value<uint64_t>() - rhs.get_clear_value<uint64_t>())
+                               & max_val_of_bitlen(lhs.get_bitlength());
+        if(lhs.is_constant() && rhs.is_constant()){
+            return plain_cons_input(value, bitlen_of_max_val(max_val), max_val);
+        }
+        if(is_zero(rhs)){
+            return lhs;
+        }
+        uint32_t const bitlen = lhs.get_bitlength();
+        return plain_gate(value, max_val, plain_depth(lhs, rhs), bitlen, 4 * bitlen, bitlen);
+    }
+
+    inline plain_share operator*(plain_share lhs, plain_share rhs){
+        uint64_t const max_val = max_val_mul(lhs.get_max_val(), rhs.get_max_val());
+        uint64_t const value = lhs.get_clear_value<uint64_t>() * rhs.get_clear_value<uint64_t>();
+        if(lhs.is_constant() && rhs.is_constant()){
+            return plain_cons_input(value, bitlen_of_max_val(max_val), max_val);
+        }
+        if(is_zero(lhs)){
+            return lhs;
+        }
+        if(is_zero(rhs)){
+            return rhs;
+        }
+        //schoolbook multiplication, a partial product and an addition per bit of rhs
+        uint64_t const n = lhs.get_bitlength(), m = rhs.get_bitlength();
+        return plain_gate(
+            value, max_val, plain_depth(lhs, rhs),
+            2 * n * m, 4 * n * m, static_cast<uint32_t>(n + m)
+        );
+    }
+
+    inline plain_share operator>(plain_share lhs, plain_share rhs){
+        uint64_t const value = lhs.get_clear_value<uint64_t>() > rhs.get_clear_value<uint64_t>();
+        if(lhs.is_constant() && rhs.is_constant()){
+            return plain_cons_input(value, 1u, 1u);
+        }
+        uint32_t const bitlen = std::max(lhs.get_bitlength(), rhs.get_bitlength());
+        return plain_gate(value, 1u, plain_depth(lhs, rhs), bitlen, 3 * bitlen, bitlen);
+    }
+
+    inline plain_share if_else(plain_share condition, plain_share if_true, plain_share if_false){
+        uint64_t const max_val = std::max(if_true.get_max_val(), if_false.get_max_val());
+        if(condition.is_constant()){
+            return condition.constant_value() ? if_true : if_false;
+        }
+        plain_share const& selected = condition.get_clear_value<uint64_t>() ? if_true : if_false;
+        if(if_true.is_constant() && if_false.is_constant() && condition.get_bitlength() == 1){
+            //the bits are wired to the condition or its negation
+            return plain_gate(selected.get_clear_value<uint64_t>(), max_val, condition.depth(), 0, 1, 0);
+        }
+        uint32_t const bitlen = bitlen_of_max_val(max_val);
+        uint32_t const depth = std::max(condition.depth(), plain_depth(if_true, if_false));
+        return plain_gate(selected.get_clear_value<uint64_t>(), max_val, depth, bitlen, 2 * bitlen, 1);
+    }
+
+    inline plain_share concat(plain_share lhs, plain_share rhs){
+        uint32_t const shift = rhs.get_bitlength();
+        return plain_share(
+            (lhs.get_clear_value<uint64_t>() << shift) | rhs.get_clear_value<uint64_t>(),
+            lhs.get_bitlength() + shift,
+            (lhs.get_max_val() << shift) | rhs.get_max_val(),
+            plain_depth(lhs, rhs),
+            lhs.is_constant() && rhs.is_constant()
+        );
+    }
+
+    inline plain_share expand(plain_share to_expand, std::size_t new_size){
+        uint32_t const old_size = to_expand.get_bitlength();
+        uint64_t const msb = (to_expand.get_clear_value<uint64_t>() >> (old_size - 1)) & 1u;
+        uint64_t const fill = msb ? max_val_of_bitlen(new_size - old_size) << old_size : 0u;
+        return plain_share(
+            to_expand.get_clear_value<uint64_t>() | fill,
+            static_cast<uint32_t>(new_size),
+            (max_val_of_bitlen(new_size - old_size) << old_size) | to_expand.get_max_val(),
+            to_expand.depth(),
+            to_expand.is_constant()
+        );
+    }
+}
+
+#endif
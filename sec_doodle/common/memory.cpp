@@ -0,0 +1,76 @@
+/**
+ \file 		memory.cpp
+ \author	oliver.schick92@gmail.com
+ \copyright	ABY - A Framework for Efficient Mixed-protocol Secure Two-party Computation
+ Copyright (C) 2019 Engineering Cryptographic Protocols Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+            it under the terms of the GNU Lesser General Public License as published
+            by the Free Software Foundation, either version 3 of the License, or
+            (at your option) any later version.
+            ABY is distributed in the hope that it will be useful,
+            but WITHOUT ANY WARRANTY; without even the implied warranty of
+            MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+            GNU Lesser General Public License for more details.
+            You should have received a copy of the GNU Lesser General Public License
+            along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "memory.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace{
+
+allocation_counter* hook_counter = nullptr;
+
+}
+
+void set_allocation_counter(allocation_counter* const counter){
+    hook_counter = counter;
+}
+
+allocation_counter* counted_allocations(){
+    return hook_counter;
+}
+
+memory_usage read_memory_usage(){
+    memory_usage usage;
+    //stdio instead of streams, which would allocate while the allocations
+    //are being counted
+    if(std::FILE* const status = std::fopen("/proc/self/status", "r")){
+        char line[256];
+        while(std::fgets(line, sizeof(line), status) != nullptr){
+            unsigned long long kb = 0;
+            if(std::sscanf(line, "VmRSS: %llu kB", &kb) == 1){
+                usage.rss_bytes = kb * 1024;
+            }
+            else if(std::sscanf(line, "VmHWM: %llu kB", &kb) == 1){
+                usage.peak_rss_bytes = kb * 1024;
+            }
+        }
+        std::fclose(status);
+    }
+    if(allocation_counter const* const counter = counted_allocations()){
+        usage.allocations = counter->allocations;
+        usage.allocated_bytes = counter->allocated_bytes;
+        usage.live_bytes = counter->live_bytes;
+    }
+    return usage;
+}
+
+bool growth_tracker::add(uint64_t const bytes){
+    bytes_.emplace_back(bytes);
+    if(bytes_.size() > window_ + 1){
+        bytes_.pop_front();
+    }
+    if(bytes_.size() < window_ + 1){
+        return false;
+    }
+    for(std::size_t i = 1; i < bytes_.size(); ++i){
+        if(bytes_[i] <= bytes_[i - 1]){
+            return false;
+        }
+    }
+    return true;
+}
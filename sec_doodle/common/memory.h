@@ -0,0 +1,89 @@
+/**
+ \file 		memory.h
+ \author	oliver.schick92@gmail.com
+ \copyright	ABY - A Framework for Efficient Mixed-protocol Secure Two-party Computation
+ Copyright (C) 2019 Engineering Cryptographic Protocols Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+            it under the terms of the GNU Lesser General Public License as published
+            by the Free Software Foundation, either version 3 of the License, or
+            (at your option) any later version.
+            ABY is distributed in the hope that it will be useful,
+            but WITHOUT ANY WARRANTY; without even the implied warranty of
+            MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+            GNU Lesser General Public License for more details.
+            You should have received a copy of the GNU Lesser General Public License
+            along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ABY_SEC_DOODLE_MEMORY_H_19102026_2250
+#define ABY_SEC_DOODLE_MEMORY_H_19102026_2250
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+//Counts the allocations of the whole process, including those of ABY. The
+//counting operator new is only linked in with common/allocation_hook.cpp,
+//which registers the counter with set_allocation_counter.
+struct allocation_counter{
+    std::atomic<uint64_t> allocations{0}, allocated_bytes{0}, live_bytes{0}, peak_bytes{0};
+
+    void allocated(std::size_t const size){
+        ++allocations;
+        allocated_bytes += size;
+        uint64_t const live = live_bytes += size;
+        uint64_t peak = peak_bytes;
+        while(live > peak && !peak_bytes.compare_exchange_weak(peak, live)){}
+    }
+
+    void freed(std::size_t const size){
+        live_bytes -= size;
+    }
+
+    //restarts the counts, the peak starts at the memory currently in use
+    void reset(){
+        allocations = 0;
+        allocated_bytes = 0;
+        peak_bytes = live_bytes.load();
+    }
+};
+
+void set_allocation_counter(allocation_counter* counter);
+
+//the counter of the allocation hook, nullptr if it is not linked in
+allocation_counter* counted_allocations();
+
+//memory of the process at one point in time; the allocation counts are
+//those since the last reset of the counter and 0 without the hook
+struct memory_usage{
+    //resident set size and its peak over the lifetime of the process
+    uint64_t rss_bytes = 0, peak_rss_bytes = 0;
+    uint64_t allocations = 0, allocated_bytes = 0, live_bytes = 0;
+};
+
+//reads the resident set sizes from /proc/self/status, which only exists on Linux
+memory_usage read_memory_usage();
+
+//Flags memory that grows after each of window consecutive polls, e.g. leaked
+//shares, as opposed to memory that is reused from poll to poll.
+class growth_tracker{
+public:
+    explicit growth_tracker(std::size_t window = 8)
+    : window_(window) {}
+
+    //adds the memory in use after a poll, returns whether it grew after each
+    //of the last window polls
+    bool add(uint64_t bytes);
+
+    //growth over the last window polls
+    uint64_t growth() const{
+        return bytes_.size() < 2 || bytes_.back() < bytes_.front() ? 0 : bytes_.back() - bytes_.front();
+    }
+
+private:
+    std::size_t window_;
+    std::deque<uint64_t> bytes_;
+};
+
+#endif
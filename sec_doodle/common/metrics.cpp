@@ -0,0 +1,203 @@
+/**
+ \file 		metrics.cpp
+ \author	oliver.schick92@gmail.com
+ \copyright	ABY - A Framework for Efficient Mixed-protocol Secure Two-party Computation
+ Copyright (C) 2019 Engineering Cryptographic Protocols Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+            it under the terms of the GNU Lesser General Public License as published
+            by the Free Software Foundation, either version 3 of the License, or
+            (at your option) any later version.
+            ABY is distributed in the hope that it will be useful,
+            but WITHOUT ANY WARRANTY; without even the implied warranty of
+            MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+            GNU Lesser General Public License for more details.
+            You should have received a copy of the GNU Lesser General Public License
+            along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "metrics.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+histogram::histogram(std::vector<double> upper_bounds)
+: upper_bounds_(std::move(upper_bounds)), counts_(upper_bounds_.size(), 0){
+    assert(std::is_sorted(upper_bounds_.begin(), upper_bounds_.end()));
+}
+
+void histogram::observe(double const v){
+    std::size_t const bucket = std::lower_bound(upper_bounds_.begin(), upper_bounds_.end(), v) - upper_bounds_.begin();
+    std::lock_guard<std::mutex> lock(m_);
+    if(bucket < counts_.size()){
+        ++counts_[bucket];
+    }
+    sum_ += v;
+    ++count_;
+}
+
+void histogram::write(std::ostream& os, std::string const& name, std::string const& labels) const{
+    std::lock_guard<std::mutex> lock(m_);
+    std::string const separator = labels.empty() ? "" : ",";
+    //the buckets of the text format are cumulative
+    uint64_t cumulative = 0;
+    for(std::size_t i = 0; i < upper_bounds_.size(); ++i){
+        cumulative += counts_[i];
+        os << name << "_bucket{" << labels << separator << "le=\"" << upper_bounds_[i] << "\"} " << cumulative << '\n';
+    }
+    os << name << "_bucket{" << labels << separator << "le=\"+Inf\"} " << count_ << '\n';
+    std::string const series = labels.empty() ? "" : "{" + labels + "}";
+    os << name << "_sum" << series << ' ' << sum_ << '\n';
+    os << name << "_count" << series << ' ' << count_ << '\n';
+}
+
+std::vector<double> const& latency_buckets(){
+    static std::vector<double> const buckets{
+        0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60
+    };
+    return buckets;
+}
+
+std::vector<double> const& memory_buckets(){
+    static std::vector<double> const buckets = []{
+        std::vector<double> bounds;
+        for(double b = 16.0 * (1 << 20); b <= 64.0 * (1 << 30); b *= 2){
+            bounds.emplace_back(b);
+        }
+        return bounds;
+    }();
+    return buckets;
+}
+
+metrics_registry::family& metrics_registry::family_(std::string const& name, std::string const& help, std::string const& type){
+    family& f = families_[name];
+    if(f.type.empty()){
+        f.help = help;
+        f.type = type;
+    }
+    else if(f.type != type){
+        throw std::runtime_error("metric " + name + " registered with two types");
+    }
+    return f;
+}
+
+counter& metrics_registry::add_counter(std::string const& name, std::string const& help, std::string const& labels){
+    std::lock_guard<std::mutex> lock(m_);
+    std::unique_ptr<counter>& c = family_(name, help, "counter").counters[labels];
+    if(!c){
+        c = std::make_unique<counter>();
+    }
+    return *c;
+}
+
+histogram& metrics_registry::add_histogram(
+    std::string const& name, std::string const& help,
+    std::vector<double> const& upper_bounds, std::string const& labels
+){
+    std::lock_guard<std::mutex> lock(m_);
+    std::unique_ptr<histogram>& h = family_(name, help, "histogram").histograms[labels];
+    if(!h){
+        h = std::make_unique<histogram>(upper_bounds);
+    }
+    return *h;
+}
+
+void metrics_registry::add_callback(std::string const& name, std::string const& help, std::string const& type, std::function<double()> f){
+    std::lock_guard<std::mutex> lock(m_);
+    family_(name, help, type).callback = std::move(f);
+}
+
+void metrics_registry::write(std::ostream& os) const{
+    std::lock_guard<std::mutex> lock(m_);
+    //byte counters exceed the default precision
+    auto const precision = os.precision(15);
+    for(auto const& named : families_){
+        std::string const& name = named.first;
+        family const& f = named.second;
+        os << "# HELP " << name << ' ' << f.help << '\n';
+        os << "# TYPE " << name << ' ' << f.type << '\n';
+        if(f.callback){
+            os << name << ' ' << f.callback() << '\n';
+        }
+        for(auto const& c : f.counters){
+            os << name << (c.first.empty() ? "" : "{" + c.first + "}") << ' ' << c.second->value() << '\n';
+        }
+        for(auto const& h : f.histograms){
+            h.second->write(os, name, h.first);
+        }
+    }
+    os.precision(precision);
+}
+
+metrics_endpoint::metrics_endpoint(uint16_t const port, metrics_registry const& registry)
+: registry_(registry){
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    //the metrics are only meant for a collector on the same host
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socket_ = socket(AF_INET, SOCK_STREAM, 0);
+    if(socket_ < 0){
+        throw std::runtime_error("metrics error: could not create socket");
+    }
+    int const reuse = 1;
+    setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if(::bind(socket_, (sockaddr*) &addr, sizeof(addr)) < 0 || ::listen(socket_, 8) < 0){
+        close(socket_);
+        throw std::runtime_error("metrics error: could not listen on port " + std::to_string(port));
+    }
+}
+
+metrics_endpoint::~metrics_endpoint(){
+    close(socket_);
+}
+
+void metrics_endpoint::serve() const{
+    while(true){
+        int const client = accept(socket_, nullptr, nullptr);
+        if(client < 0){
+            continue;
+        }
+        //a client that stops sending or reading must not block the endpoint,
+        //so every recv and send times out and the request has a deadline
+        timeval const timeout{2, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout.tv_sec);
+        //the request is not parsed, every request gets the metrics, but it is
+        //read up to the end of its header so the client sees no reset
+        std::string request;
+        char buffer[1024];
+        while(request.find("\r\n\r\n") == std::string::npos && request.size() < 64 * 1024
+              && std::chrono::steady_clock::now() < deadline){
+            ssize_t const n = recv(client, buffer, sizeof(buffer), 0);
+            if(n <= 0){
+                break;
+            }
+            request.append(buffer, n);
+        }
+        std::ostringstream body;
+        registry_.write(body);
+        std::string const content = body.str();
+        std::string const response =
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: " + std::to_string(content.size()) + "\r\n"
+            "Connection: close\r\n\r\n" + content;
+        for(std::size_t sent = 0; sent < response.size();){
+            ssize_t const n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if(n <= 0){
+                break;
+            }
+            sent += n;
+        }
+        close(client);
+    }
+}
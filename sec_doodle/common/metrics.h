@@ -0,0 +1,123 @@
+/**
+ \file 		metrics.h
+ \author	oliver.schick92@gmail.com
+ \copyright	ABY - A Framework for Efficient Mixed-protocol Secure Two-party Computation
+ Copyright (C) 2019 Engineering Cryptographic Protocols Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+            it under the terms of the GNU Lesser General Public License as published
+            by the Free Software Foundation, either version 3 of the License, or
+            (at your option) any later version.
+            ABY is distributed in the hope that it will be useful,
+            but WITHOUT ANY WARRANTY; without even the implied warranty of
+            MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+            GNU Lesser General Public License for more details.
+            You should have received a copy of the GNU Lesser General Public License
+            along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ABY_SEC_DOODLE_METRICS_H_19102026_2015
+#define ABY_SEC_DOODLE_METRICS_H_19102026_2015
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+//a value that only increases, e.g. a number of bytes
+class counter{
+public:
+    void add(double const v){
+        std::lock_guard<std::mutex> lock(m_);
+        value_ += v;
+    }
+
+    double value() const{
+        std::lock_guard<std::mutex> lock(m_);
+        return value_;
+    }
+
+private:
+    mutable std::mutex m_;
+    double value_ = 0;
+};
+
+//distribution of observations, counted in buckets by their upper bounds
+class histogram{
+public:
+    explicit histogram(std::vector<double> upper_bounds);
+
+    void observe(double v);
+
+    //writes the buckets, sum and count of the series name{labels}
+    void write(std::ostream& os, std::string const& name, std::string const& labels) const;
+
+private:
+    mutable std::mutex m_;
+    std::vector<double> upper_bounds_;
+    std::vector<uint64_t> counts_;
+    double sum_ = 0;
+    uint64_t count_ = 0;
+};
+
+//upper bounds in seconds for latencies from less than a millisecond to a minute
+std::vector<double> const& latency_buckets();
+
+//upper bounds in bytes for the memory of a process from 16 MiB to 64 GiB
+std::vector<double> const& memory_buckets();
+
+//Metrics of a process, written in the Prometheus text format. The metrics are
+//created once and can then be updated from any thread. Metrics of the same
+//name are one family and differ in their labels, e.g. phase="online".
+class metrics_registry{
+public:
+    counter& add_counter(std::string const& name, std::string const& help, std::string const& labels = "");
+
+    histogram& add_histogram(
+        std::string const& name, std::string const& help,
+        std::vector<double> const& upper_bounds, std::string const& labels = ""
+    );
+
+    //a metric read from f whenever the metrics are written; type is gauge
+    //or counter
+    void add_callback(std::string const& name, std::string const& help, std::string const& type, std::function<double()> f);
+
+    void write(std::ostream& os) const;
+
+private:
+    struct family{
+        std::string help, type;
+        std::map<std::string, std::unique_ptr<counter>> counters;
+        std::map<std::string, std::unique_ptr<histogram>> histograms;
+        std::function<double()> callback;
+    };
+
+    family& family_(std::string const& name, std::string const& help, std::string const& type);
+
+    mutable std::mutex m_;
+    std::map<std::string, family> families_;
+};
+
+//Serves the metrics of a registry over HTTP on a local port, to every
+//request regardless of its path.
+class metrics_endpoint{
+public:
+    metrics_endpoint(uint16_t port, metrics_registry const& registry);
+
+    metrics_endpoint(metrics_endpoint const&) = delete;
+    metrics_endpoint& operator=(metrics_endpoint const&) = delete;
+
+    ~metrics_endpoint();
+
+    //answers requests until the process ends
+    void serve() const;
+
+private:
+    metrics_registry const& registry_;
+    int socket_;
+};
+
+#endif
@@ -0,0 +1,229 @@
+/**
+ \file 		net_relay.cpp
+ \author	oliver.schick92@gmail.com
+ \copyright	ABY - A Framework for Efficient Mixed-protocol Secure Two-party Computation
+ Copyright (C) 2019 Engineering Cryptographic Protocols Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+            it under the terms of the GNU Lesser General Public License as published
+            by the Free Software Foundation, either version 3 of the License, or
+            (at your option) any later version.
+            ABY is distributed in the hope that it will be useful,
+            but WITHOUT ANY WARRANTY; without even the implied warranty of
+            MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+            GNU Lesser General Public License for more details.
+            You should have received a copy of the GNU Lesser General Public License
+            along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "net_relay.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+net_profile parse_net_profile(std::string const& profile){
+    if(profile == "lan"){
+        return net_profile{0.5, 1000, 0.05};
+    }
+    if(profile == "metro"){
+        return net_profile{10, 100, 1};
+    }
+    if(profile == "wan"){
+        return net_profile{100, 20, 5};
+    }
+    net_profile result;
+    std::istringstream is(profile);
+    char comma = ',';
+    if(!(is >> result.rtt_ms >> comma) || comma != ',' || !(is >> result.bandwidth_mbit)){
+        throw std::runtime_error("invalid network profile " + profile);
+    }
+    if(is >> comma && (comma != ',' || !(is >> result.jitter_ms))){
+        throw std::runtime_error("invalid network profile " + profile);
+    }
+    if(result.rtt_ms < 0 || result.bandwidth_mbit < 0 || result.jitter_ms < 0){
+        throw std::runtime_error("invalid network profile " + profile);
+    }
+    return result;
+}
+
+net_relay::net_relay(uint16_t const listen_port, std::string target_address, uint16_t const target_port, net_profile const profile)
+: target_address_(std::move(target_address)), target_port_(target_port), profile_(profile){
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(listen_port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    socket_ = socket(AF_INET, SOCK_STREAM, 0);
+    if(socket_ < 0){
+        throw std::runtime_error("relay error: could not create socket");
+    }
+    int const reuse = 1;
+    setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if(::bind(socket_, (sockaddr*) &addr, sizeof(addr)) < 0 || ::listen(socket_, 8) < 0){
+        close(socket_);
+        throw std::runtime_error("relay error: could not listen on port " + std::to_string(listen_port));
+    }
+    acceptor_ = std::thread([this]{ accept_connections_(); });
+}
+
+net_relay::~net_relay(){
+    stopping_ = true;
+    //unblocks accept and the reads of the relaying threads
+    shutdown(socket_, SHUT_RDWR);
+    close(socket_);
+    acceptor_.join();
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        for(int const s : connections_){
+            shutdown(s, SHUT_RDWR);
+        }
+    }
+    for(std::thread& t : threads_){
+        t.join();
+    }
+    for(int const s : connections_){
+        close(s);
+    }
+}
+
+void net_relay::accept_connections_(){
+    while(!stopping_){
+        int const client = accept(socket_, nullptr, nullptr);
+        if(client < 0){
+            if(errno == EINTR || errno == ECONNABORTED){
+                continue;
+            }
+            //out of descriptors or buffers, accept would fail again at once
+            if(errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM){
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            //the listening socket is closed or broken
+            break;
+        }
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(target_port_);
+        inet_pton(AF_INET, target_address_.c_str(), &addr.sin_addr);
+        int const target = socket(AF_INET, SOCK_STREAM, 0);
+        if(target < 0 || connect(target, (sockaddr*) &addr, sizeof(addr)) < 0){
+            if(target >= 0){
+                close(target);
+            }
+            close(client);
+            continue;
+        }
+        //the relay delays the data itself, so it must not be held back further
+        int const no_delay = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+        setsockopt(target, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+        std::lock_guard<std::mutex> lock(m_);
+        if(stopping_){
+            close(client);
+            close(target);
+            break;
+        }
+        connections_.emplace_back(client);
+        connections_.emplace_back(target);
+        threads_.emplace_back([this, client, target]{ relay_(client, target); });
+        threads_.emplace_back([this, client, target]{ relay_(target, client); });
+    }
+}
+
+//Reads the data of one direction and writes it on a second thread once it
+//would have arrived: the data leaves the link serialized at the bandwidth
+//and arrives half the rtt (plus jitter) later, in the order it was sent.
+//At most max_in_flight bytes are held, beyond that reading waits for the
+//writer like a full TCP window would. Once writing fails, reading stops.
+void net_relay::relay_(int const from, int const to){
+    using clock = std::chrono::steady_clock;
+    std::size_t const max_in_flight = 4 * 1024 * 1024;
+    struct chunk{
+        clock::time_point release;
+        std::vector<char> data;
+    };
+    std::deque<chunk> in_flight;
+    std::size_t in_flight_bytes = 0;
+    bool closed = false;
+    bool write_failed = false;
+    std::mutex m;
+    //signals data to write, and room for more data respectively
+    std::condition_variable readable, writable;
+
+    std::thread writer([&]{
+        std::unique_lock<std::mutex> lock(m);
+        while(true){
+            readable.wait(lock, [&]{ return closed || !in_flight.empty(); });
+            if(in_flight.empty()){
+                break;
+            }
+            chunk c = std::move(in_flight.front());
+            in_flight.pop_front();
+            in_flight_bytes -= c.data.size();
+            writable.notify_one();
+            lock.unlock();
+            std::this_thread::sleep_until(c.release);
+            bool failed = false;
+            for(std::size_t sent = 0; sent < c.data.size() && !failed;){
+                ssize_t const n = send(to, c.data.data() + sent, c.data.size() - sent, MSG_NOSIGNAL);
+                failed = n <= 0;
+                sent += failed ? 0 : n;
+            }
+            lock.lock();
+            if(failed){
+                write_failed = true;
+                writable.notify_one();
+                //unblocks the read, the data would not be delivered anyway
+                shutdown(from, SHUT_RD);
+                break;
+            }
+        }
+        shutdown(to, SHUT_WR);
+    });
+
+    std::mt19937 rng(std::random_device{}());
+    std::uniform_real_distribution<double> jitter(0, profile_.jitter_ms);
+    auto const to_duration = [](double const ms){
+        return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double, std::milli>(ms));
+    };
+    clock::time_point transmitted = clock::now(), released = clock::now();
+    //small chunks keep the pacing of the bandwidth smooth
+    std::vector<char> buffer(16 * 1024);
+    while(true){
+        ssize_t const n = recv(from, buffer.data(), buffer.size(), 0);
+        if(n <= 0){
+            break;
+        }
+        {
+            std::unique_lock<std::mutex> lock(m);
+            writable.wait(lock, [&]{ return write_failed || in_flight_bytes < max_in_flight; });
+            if(write_failed){
+                break;
+            }
+            //data held back by a full relay enters the link once there is room
+            clock::time_point const arrival = clock::now();
+            double const transmission_ms = profile_.bandwidth_mbit > 0 ? n * 8 / (profile_.bandwidth_mbit * 1000) : 0;
+            transmitted = std::max(transmitted, arrival) + to_duration(transmission_ms);
+            released = std::max(released, transmitted + to_duration(profile_.rtt_ms / 2 + jitter(rng)));
+            in_flight.emplace_back(chunk{released, std::vector<char>(buffer.begin(), buffer.begin() + n)});
+            in_flight_bytes += n;
+        }
+        readable.notify_one();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m);
+        closed = true;
+    }
+    readable.notify_one();
+    writer.join();
+}
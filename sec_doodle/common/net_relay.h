@@ -0,0 +1,67 @@
+/**
+ \file 		net_relay.h
+ \author	oliver.schick92@gmail.com
+ \copyright	ABY - A Framework for Efficient Mixed-protocol Secure Two-party Computation
+ Copyright (C) 2019 Engineering Cryptographic Protocols Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+            it under the terms of the GNU Lesser General Public License as published
+            by the Free Software Foundation, either version 3 of the License, or
+            (at your option) any later version.
+            ABY is distributed in the hope that it will be useful,
+            but WITHOUT ANY WARRANTY; without even the implied warranty of
+            MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+            GNU Lesser General Public License for more details.
+            You should have received a copy of the GNU Lesser General Public License
+            along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ABY_SEC_DOODLE_NET_RELAY_H_19102026_1840
+#define ABY_SEC_DOODLE_NET_RELAY_H_19102026_1840
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//network conditions the relay emulates in each direction of a connection
+struct net_profile{
+    double rtt_ms = 0;
+    //in Mbit/s, 0 is unlimited
+    double bandwidth_mbit = 0;
+    //the delay of the data varies by up to this much, without reordering it
+    double jitter_ms = 0;
+};
+
+//the profile lan, metro or wan, or one given as rtt_ms,bandwidth_mbit[,jitter_ms]
+net_profile parse_net_profile(std::string const& profile);
+
+//Accepts TCP connections on listen_port and relays each to target_port on
+//target_address, delaying the data of both directions as a link with the
+//given profile would. Runs on background threads until it is destroyed.
+class net_relay{
+public:
+    net_relay(uint16_t listen_port, std::string target_address, uint16_t target_port, net_profile profile);
+
+    net_relay(net_relay const&) = delete;
+    net_relay& operator=(net_relay const&) = delete;
+
+    ~net_relay();
+
+private:
+    void accept_connections_();
+    void relay_(int from, int to);
+
+    std::string target_address_;
+    uint16_t target_port_;
+    net_profile profile_;
+    int socket_;
+    std::atomic<bool> stopping_{false};
+    std::mutex m_;
+    std::vector<int> connections_;
+    std::vector<std::thread> threads_;
+    std::thread acceptor_;
+};
+
+#endif
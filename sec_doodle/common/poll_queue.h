@@ -0,0 +1,121 @@
+/**
+ \file 		poll_queue.h
+ \author	oliver.schick92@gmail.com
+ \copyright	ABY - A Framework for Efficient Mixed-protocol Secure Two-party Computation
+ Copyright (C) 2019 Engineering Cryptographic Protocols Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+            it under the terms of the GNU Lesser General Public License as published
+            by the Free Software Foundation, either version 3 of the License, or
+            (at your option) any later version.
+            ABY is distributed in the hope that it will be useful,
+            but WITHOUT ANY WARRANTY; without even the implied warranty of
+            MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+            GNU Lesser General Public License for more details.
+            You should have received a copy of the GNU Lesser General Public License
+            along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ABY_SEC_DOODLE_POLL_QUEUE_H_19102026_0930
+#define ABY_SEC_DOODLE_POLL_QUEUE_H_19102026_0930
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <vector>
+
+//queue of polls waiting for evaluation, filled by the thread receiving the
+//polls and emptied by the thread executing the circuits
+template<typename T>
+class poll_queue{
+public:
+    void push(T t){
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            queue_.push_back(std::move(t));
+        }
+        cv_.notify_all();
+    }
+
+    //puts [first, last) back in front of the queue, keeping their order
+    template<typename InputIt>
+    void push_front(InputIt first, InputIt last){
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            queue_.insert(queue_.begin(), first, last);
+        }
+        cv_.notify_all();
+    }
+
+    //blocks until at least one poll satisfying pred is available and then
+    //keeps collecting such polls until max_size polls are collected or
+    //window has passed, the other polls stay in the queue
+    template<typename UnaryPredicate>
+    std::vector<T> pop_batch(
+        std::size_t const max_size,
+        std::chrono::milliseconds const window,
+        UnaryPredicate pred
+    ){
+        std::vector<T> batch;
+        std::unique_lock<std::mutex> lock(m_);
+        auto first_match = [&]{
+            return std::find_if(queue_.begin(), queue_.end(), pred);
+        };
+        cv_.wait(lock, [&]{ return first_match() != queue_.end(); });
+        auto const deadline = std::chrono::steady_clock::now() + window;
+        while(batch.size() < max_size){
+            auto it = first_match();
+            if(it == queue_.end()){
+                if(!cv_.wait_until(lock, deadline, [&]{ return first_match() != queue_.end(); })){
+                    break;
+                }
+                it = first_match();
+            }
+            batch.emplace_back(std::move(*it));
+            queue_.erase(it);
+        }
+        return batch;
+    }
+
+    std::vector<T> pop_batch(std::size_t const max_size, std::chrono::milliseconds const window){
+        return pop_batch(max_size, window, [](T const&){ return true; });
+    }
+
+    //blocks until a poll satisfying pred is available and removes it
+    template<typename UnaryPredicate>
+    T pop_if(UnaryPredicate pred){
+        return std::move(pop_batch(1, std::chrono::milliseconds(0), pred).front());
+    }
+
+    //blocks until the queue is not empty and returns f(front of the queue)
+    template<typename F>
+    auto peek(F f) const{
+        std::unique_lock<std::mutex> lock(m_);
+        cv_.wait(lock, [this]{ return !queue_.empty(); });
+        return f(queue_.front());
+    }
+
+    //blocks until the queue is not empty and returns f(poll with the smallest key)
+    template<typename Key, typename F>
+    auto peek_min(Key key, F f) const{
+        std::unique_lock<std::mutex> lock(m_);
+        cv_.wait(lock, [this]{ return !queue_.empty(); });
+        return f(*std::min_element(queue_.begin(), queue_.end(), [&](T const& lhs, T const& rhs){
+            return key(lhs) < key(rhs);
+        }));
+    }
+
+    std::size_t size() const{
+        std::lock_guard<std::mutex> lock(m_);
+        return queue_.size();
+    }
+
+private:
+    mutable std::mutex m_;
+    mutable std::condition_variable cv_;
+    std::deque<T> queue_;
+};
+
+#endif
@@ -20,6 +20,7 @@
 #include <iomanip>
 #include <ostream>
 #include <fstream>
+#include <sstream>
 #include <functional>
 #include <iterator>
 #include <limits>
@@ -29,12 +30,21 @@
 #include <algorithm>
 #include <type_traits>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <iostream>
+#include <cstdlib>
+#include <exception>
+#include <stdexcept>
 #include <chrono>
+#include <cassert>
 
 #include <abycore/sharing/sharing.h>
 
 #include "sec_doodle.h"
 #include "faby.h"
+#include "faby_plain.h"
+#include "trace.h"
 
 constexpr std::size_t GMW = 0, YAO = 1, GMW_WEIGHTED = 2, YAO_WEIGHTED = 3,
                       GMW_HYBRID = 4, YAO_HYBRID = 5, GMW_WEIGHTED_HYBRID = 6, YAO_WEIGHTED_HYBRID = 7,
@@ -154,10 +164,80 @@ struct arithmetic_to{
 
 };
 
+//adds two tuples of column sums
 constexpr struct{
-    template<typename InputFunction, typename Conversion = decltype(InputFunction::get_conversion())>
-    share* operator()(
-        doodle_table const& in_dt,
+    template<typename LTuple, typename RTuple>
+    auto operator()(LTuple&& lhs, RTuple&& rhs) const{
+        using namespace faby;
+        //faby::print_value(std::get<0>(lhs), "lhs1");
+        //faby::print_value(std::get<1>(lhs), "lhs2");
+        //faby::print_value(std::get<0>(rhs), "rhs1");
+        //faby::print_value(std::get<1>(rhs), "rhs2");
+        //faby::print_value(std::get<0>(lhs) + std::get<0>(rhs), "lhs1 + rhs1");
+        return std::make_tuple(
+            std::get<0>(lhs) + std::get<0>(rhs),
+            std::get<1>(lhs) + std::get<1>(rhs)
+        );
+    }
+} add_column_sums;
+
+//selects the tuple (index, value) with the smaller value, on ties t1
+constexpr struct{
+    template<typename Tuple1, typename Tuple2>
+    auto operator()(Tuple1&& t1, Tuple2&& t2) const{
+        using share_t = std::decay_t<decltype(std::get<0>(t1))>;
+        share_t min_index_t1, min_value_t1, min_index_t2, min_value_t2;
+        std::tie(min_index_t1, min_value_t1) = t1;
+        std::tie(min_index_t2, min_value_t2) = t2;
+        share_t gt = min_value_t1 > min_value_t2;
+        return std::make_tuple(
+            if_else(gt, min_index_t2, min_index_t1),
+            if_else(gt, min_value_t2, min_value_t1)
+        );
+    }
+} select_min;
+
+//merges two lists of (index, key) tuples sorted by key into the sorted list
+//of the k tuples with the smallest keys; the keys have to be distinct
+struct select_top_k{
+    std::size_t k;
+
+    template<typename List>
+    List operator()(List lhs, List const& rhs) const{
+        for(std::size_t i = 0; i < rhs.size() && i < k; ++i){
+            bool const drop_last = lhs.size() >= k;
+            lhs.emplace_back(rhs[i]);
+            //rhs is sorted, so rhs[i] ends up behind the rhs[j], j < i, already
+            //inserted and needs no comparisons with them
+            for(std::size_t j = lhs.size() - 1; j > i; --j){
+                auto& lower = lhs[j - 1];
+                auto& upper = lhs[j];
+                auto const gt = std::get<1>(lower) > std::get<1>(upper);
+                auto const min = std::make_tuple(
+                    if_else(gt, std::get<0>(upper), std::get<0>(lower)),
+                    if_else(gt, std::get<1>(upper), std::get<1>(lower))
+                );
+                //the maximum of the last pair is dropped anyway
+                if(!drop_last || j != lhs.size() - 1){
+                    upper = std::make_tuple(
+                        if_else(gt, std::get<0>(lower), std::get<0>(upper)),
+                        if_else(gt, std::get<1>(lower), std::get<1>(upper))
+                    );
+                }
+                lower = min;
+            }
+            if(drop_last){
+                lhs.pop_back();
+            }
+        }
+        return lhs;
+    }
+};
+
+constexpr struct{
+    template<typename Table, typename InputFunction, typename Conversion = decltype(InputFunction::get_conversion())>
+    auto operator()(
+        Table const& in_dt,
         InputFunction const& input_function,
         Conversion conv = InputFunction::get_conversion()
     ) const {
@@ -169,39 +249,23 @@ constexpr struct{
         //the type of the list and the type of share_t is yet only
         //known to the compiler
         auto column_sums = in_dt.get_columns() | transformed([&](auto const& column){
+            circuit_stage_scope const stage(circuit_stage::column_sums);
             auto t = tree_accumulate(
                 column,
-                [](auto&& lhs, auto&& rhs){
-                    using namespace faby;
-                    //faby::print_value(std::get<0>(lhs), "lhs1");
-                    //faby::print_value(std::get<1>(lhs), "lhs2");
-                    //faby::print_value(std::get<0>(rhs), "rhs1");
-                    //faby::print_value(std::get<1>(rhs), "rhs2");
-                    //faby::print_value(std::get<0>(lhs) + std::get<0>(rhs), "lhs1 + rhs1");
-                    return std::make_tuple(
-                        std::get<0>(lhs) + std::get<0>(rhs),
-                        std::get<1>(lhs) + std::get<1>(rhs)
-                    );
-                },
-                input_function
+                add_column_sums,
+                [&](auto const& entry, std::size_t idx){
+                    circuit_stage_scope const stage(circuit_stage::input);
+                    return apply_leaf(input_function, entry, idx);
+                }
             );
             return t;
 
         });
 
+        circuit_stage_scope const stage(circuit_stage::argmin);
         auto result = tree_accumulate(
             column_sums,
-            [](auto&& t1, auto&& t2){
-                using share_t = std::decay_t<decltype(std::get<0>(t1))>;
-                share_t min_index_t1, min_value_t1, min_index_t2, min_value_t2;
-                std::tie(min_index_t1, min_value_t1) = t1;
-                std::tie(min_index_t2, min_value_t2) = t2;
-                share_t gt = min_value_t1 > min_value_t2;
-                return std::make_tuple(
-                    if_else(gt, min_index_t2, min_index_t1),
-                    if_else(gt, min_value_t2, min_value_t1)
-                );
-            },
+            select_min,
             [&](auto&& sum, std::size_t idx){
                 using share_t = std::decay_t<decltype(conv(std::get<0>(sum)))>;
                 using circuit_t = typename share_t::circuit_t;
@@ -226,20 +290,25 @@ constexpr struct{
 } buildColumnSumCircuit;
 
 constexpr struct{
-    template<typename NoInputFunction>
+    template<typename Table, typename NoInputFunction>
     std::vector<share*> operator()(
-        doodle_table const& dt,
+        Table const& dt,
         uint32_t col,
         NoInputFunction const& no_input_function
     ) const {
         using namespace faby;
+        circuit_stage_scope const stage(circuit_stage::no_outputs);
         std::vector<share*> res;
         res.reserve(dt.column_size());
         for(doodle_entry const& de : dt.column(col)){
+            auto no = [&]{
+                circuit_stage_scope const stage(circuit_stage::input);
+                return no_input_function(de);
+            }();
             #ifdef TESTING
-            res.emplace_back(output(no_input_function(de), ALL));
+            res.emplace_back(output(no, ALL));
             #else
-            res.emplace_back(output(no_input_function(de), SERVER));
+            res.emplace_back(output(no, SERVER));
             #endif
         }
         return res;
@@ -247,17 +316,21 @@ constexpr struct{
 
 } retrieve_nos;
 
-std::tuple<doodle_table, doodle_table, doodle_table> generate_tables(std::size_t rows, std::size_t columns, bool is_arithmetic){
-    static struct {
-        uint32_t state = (srand(time(NULL)), rand());
+std::tuple<doodle_table, doodle_table, doodle_table> generate_tables(
+    std::size_t rows,
+    std::size_t columns,
+    bool is_arithmetic,
+    uint32_t seed
+){
+    struct {
+        uint32_t state;
         unsigned operator()(){
             state ^= state << 13;
             state ^= state >> 17;
             state ^= state << 5;
             return state;
         }
-    } rand;
-    last_rng_state = rand.state;
+    } rand{seed != 0 ? seed : 1u};
 	constexpr std::size_t max_weight = 255;
     doodle_table dt, alice_dt, bob_dt;
     dt.entries.reserve(rows*columns);
@@ -338,6 +411,37 @@ std::tuple<doodle_table, doodle_table, doodle_table> generate_tables(std::size_t
     return std::make_tuple(dt, alice_dt, bob_dt);
 }
 
+std::tuple<doodle_table, doodle_table, doodle_table> generate_tables(std::size_t rows, std::size_t columns, bool is_arithmetic){
+    static uint32_t seed = (srand(time(NULL)), rand());
+    last_rng_state = seed;
+    //the tables of a failed run can be reproduced from last_rng_state
+    seed = seed * 1664525u + 1013904223u;
+    return generate_tables(rows, columns, is_arithmetic, last_rng_state);
+}
+
+//traces the construction of a circuit from build_start to build_end and its
+//execution up to exec_end, with the setup and online phases reported by ABY;
+//the rest of the execution is spent waiting on the other party
+void trace_execution(
+    ABYParty& party,
+    char const* const name,
+    trace_clock::time_point const build_start,
+    trace_clock::time_point const build_end,
+    trace_clock::time_point const exec_end
+){
+    if(!tracing()){
+        return;
+    }
+    using ms = std::chrono::duration<double, std::milli>;
+    auto const setup = std::chrono::duration_cast<trace_clock::duration>(ms(party.GetTiming(P_SETUP)));
+    auto const online = std::chrono::duration_cast<trace_clock::duration>(ms(party.GetTiming(P_ONLINE)));
+    trace_complete(name, build_start, exec_end);
+    trace_complete("build", build_start, build_end);
+    trace_complete("ExecCircuit", build_end, exec_end);
+    trace_complete("P_SETUP", build_end, build_end + setup);
+    trace_complete("P_ONLINE", exec_end - online, exec_end);
+}
+
 constexpr struct{
 template<typename InputFunction, typename NoInputFunction, typename Conversion = decltype(InputFunction::get_conversion())>
     std::tuple<uint32_t, std::vector<bool>> operator() (
@@ -352,9 +456,23 @@ template<typename InputFunction, typename NoInputFunction, typename Conversion =
         NoInputFunction const& no_input_function,
         Conversion const& conv = InputFunction::get_conversion()
     ) const {
-        auto col = buildColumnSumCircuit(role == SERVER ? bob_dt : alice_dt, input_function, conv);
+        //the gates of each execution are reported before it resets the circuits
+        auto write_gate_stats = [&](circuit_report& report){
+            std::ostringstream stats;
+            write_circuit_report(stats, report.stages());
+            os << "gate statistics: " << stats.str() << '\n';
+        };
+        auto build_start = trace_clock::now();
+        auto col = [&]{
+            circuit_report report(*party);
+            auto col = buildColumnSumCircuit(role == SERVER ? bob_dt : alice_dt, input_function, conv);
+            write_gate_stats(report);
+            return col;
+        }();
         os << "number of AND gates: " << circ->GetNumANDGates() << '\n';
+        auto build_end = trace_clock::now();
         party->ExecCircuit();
+        trace_execution(*party, "column_sums", build_start, build_end, trace_clock::now());
         os << "setup time: "
            << party->GetTiming(P_SETUP) << '\n'
            << "online time: "
@@ -367,9 +485,16 @@ template<typename InputFunction, typename NoInputFunction, typename Conversion =
         uint32_t best_column = col->template get_clear_value<uint32_t>();
         //debug_output.eval();
         party->Reset();
-        auto nos = retrieve_nos(role == SERVER ? bob_dt : alice_dt, best_column, no_input_function);
-
+        build_start = trace_clock::now();
+        auto nos = [&]{
+            circuit_report report(*party);
+            auto nos = retrieve_nos(role == SERVER ? bob_dt : alice_dt, best_column, no_input_function);
+            write_gate_stats(report);
+            return nos;
+        }();
+        build_end = trace_clock::now();
         party->ExecCircuit();
+        trace_execution(*party, "no_retrieval", build_start, build_end, trace_clock::now());
 
         std::vector<bool> no_selections;
         no_selections.reserve(nos.size());
@@ -543,6 +668,21 @@ struct arith_input{
     }
 };
 
+//cleartext entries for simulating the circuits in faby::plain_circuit
+struct plain_input{
+    faby::plain_share operator()(uint64_t val, unsigned bitlen, uint64_t max_val) const{
+        return faby::plain_shared_input(val, bitlen, max_val);
+    }
+
+    faby::plain_share operator()(uint64_t val, unsigned bitlen) const{
+        return (*this)(val, bitlen, faby::max_val_of_bitlen(bitlen));
+    }
+
+    static auto get_conversion(){
+        return faby::identity;
+    }
+};
+
 template<typename InputPolicy>
 struct non_weighted : InputPolicy{
     using InputPolicy::InputPolicy;
@@ -568,8 +708,12 @@ struct weighted : InputPolicy{
     std::vector<input_policy_share_t> inputs;
 
     //Args... are the arguments that are forwarded to the constructor of InputPolicy
-    template<typename... Args>
-    weighted(doodle_table const& dt, Args&&... args)
+    template<
+        typename Table,
+        typename... Args,
+        std::enable_if_t<std::is_base_of<basic_doodle_table<Table>, Table>::value>* = nullptr
+    >
+    weighted(Table const& dt, Args&&... args)
     : InputPolicy(std::forward<Args>(args)...),
       max_weight(dt.max_weight),
       len(faby::bitlen_of_max_val(dt.max_weight)){
@@ -611,6 +755,36 @@ struct arith_hybrid : InputPolicy{
     }
 };
 
+//reconstructs a value shared additively modulo 2^bitlen in the yao circuit
+struct additive_yao_input{
+    e_role role;
+
+    additive_yao_input(e_role role)
+    :role(role){}
+
+    faby::yao_share operator()(uint64_t val, unsigned bitlen, uint64_t max_val) const{
+        //both parties put the input gates in the same order
+        auto input_of = [&](e_role owner){
+            return owner == role ? faby::yao_input(val, bitlen, role) : faby::yao_dummy_input(bitlen);
+        };
+        faby::yao_share server_share = input_of(SERVER);
+        faby::yao_share client_share = input_of(CLIENT);
+        //the value is at most max_val, so the carry bits of the sum are dropped
+        return faby::yao_share((server_share + client_share).get_share(), max_val);
+    }
+};
+
+//the lowest bit of the sum of the additive shares of "no" is
+//the XOR of the lowest bits of the shares
+template<typename InputPolicy>
+struct get_additive_no : InputPolicy{
+    using InputPolicy::InputPolicy;
+
+    auto operator()(doodle_entry entry) const{
+        return static_cast<InputPolicy const&>(*this)((entry >> 32) & 1u, 1u);
+    }
+};
+
 template<typename InputPolicy>
 struct get_no : InputPolicy{
     using InputPolicy::InputPolicy;
@@ -745,6 +919,7 @@ int32_t test_sec_doodle_circuit(
                 
                 for(int i = 0; i < runs; ++i){
                     std::tie(dt, alice_dt, bob_dt) = generate_tables(p, t, sh == S_ARITH);
+                    faby::share_arena arena;
                     try{
                         if(sel == GMW){
                             #ifndef CORRECTNESS
@@ -1030,18 +1205,55 @@ int32_t test_sec_doodle_circuit(
 }
 
 
-std::tuple<std::size_t, std::vector<bool>> execute_circuit(
-    ABYParty& party,
-    Circuit* circ,
-    e_role role,
-    algorithm alg,
-    doodle_table const& dt
-){
-    auto yao_ctx = faby::create_yao_context(circ);
-    auto gmw_ctx = faby::create_gmw_context(circ);
-    auto arith_ctx = faby::create_arithmetic_context(circ);
+std::function<void(phase_execution_stats const&)> execution_observer;
 
-    share* col;
+void set_execution_observer(std::function<void(phase_execution_stats const&)> observer){
+    execution_observer = std::move(observer);
+}
+
+//Executes the circuits of a phase and reports each execution to the
+//execution observer. The circuit of the first execution is built from the
+//construction of the phase_execution, those of the following ones from the
+//end of the previous execution.
+class phase_execution{
+public:
+    phase_execution(ABYParty& party, circuit_phase const phase)
+    : party_(party), phase_(phase), build_start_(std::chrono::steady_clock::now()) {}
+
+    void execute(){
+        auto const build_end = std::chrono::steady_clock::now();
+        party_.ExecCircuit();
+        trace_execution(
+            party_, phase_ == circuit_phase::column_sums ? "column_sums" : "no_retrieval",
+            build_start_, build_end, std::chrono::steady_clock::now()
+        );
+        if(execution_observer){
+            phase_execution_stats stats;
+            stats.phase = phase_;
+            stats.build_ms = std::chrono::duration<double, std::milli>(build_end - build_start_).count();
+            stats.setup_ms = party_.GetTiming(P_SETUP);
+            stats.online_ms = party_.GetTiming(P_ONLINE);
+            stats.sent_bytes = party_.GetSentData(P_SETUP) + party_.GetSentData(P_ONLINE);
+            stats.received_bytes = party_.GetReceivedData(P_SETUP) + party_.GetReceivedData(P_ONLINE);
+            for(e_sharing const sh : {S_BOOL, S_YAO}){
+                stats.and_gates += static_cast<BooleanCircuit*>(
+                    party_.GetSharings()[sh]->GetCircuitBuildRoutine()
+                )->GetNumANDGates();
+            }
+            stats.memory = read_memory_usage();
+            execution_observer(stats);
+        }
+        build_start_ = std::chrono::steady_clock::now();
+    }
+
+private:
+    ABYParty& party_;
+    circuit_phase phase_;
+    std::chrono::steady_clock::time_point build_start_;
+};
+
+share* put_column_sum_circuit(e_role role, algorithm alg, doodle_table_view const& dt){
+    share* col = nullptr;
     if(alg == algorithm::gmw){
         col = buildColumnSumCircuit(dt, non_weighted<gmw_input>{});
     }
@@ -1054,9 +1266,10 @@ std::tuple<std::size_t, std::vector<bool>> execute_circuit(
     else if(alg == algorithm::yao_weighted){
         col = buildColumnSumCircuit(dt, weighted<yao_input>{dt, role});
     }
-    party.ExecCircuit();
-    uint32_t best_column = col->template get_clear_value<uint32_t>();
-    party.Reset();
+    return col;
+}
+
+std::vector<share*> put_no_outputs(e_role role, algorithm alg, doodle_table_view const& dt, uint32_t best_column){
     std::vector<share*> nos;
     if(alg == algorithm::gmw || alg == algorithm::gmw_weighted){
         nos = retrieve_nos(dt, best_column, get_no<gmw_input>{});
@@ -1064,8 +1277,10 @@ std::tuple<std::size_t, std::vector<bool>> execute_circuit(
     else if(alg == algorithm::yao || alg == algorithm::yao_weighted){
         nos = retrieve_nos(dt, best_column, get_no<yao_input>{role});
     }
-    party.ExecCircuit();
+    return nos;
+}
 
+std::vector<bool> get_no_selections(e_role role, std::vector<share*> const& nos){
     std::vector<bool> no_selections;
     if(role == SERVER){
         no_selections.reserve(nos.size());
@@ -1073,6 +1288,1083 @@ std::tuple<std::size_t, std::vector<bool>> execute_circuit(
             no_selections.emplace_back(s->template get_clear_value<bool>());
         }
     }
+    return no_selections;
+}
+
+//faby contexts for the circuits of all sharings of a party, the shares
+//built in them are deleted together with the contexts. The constant pool and
+//the expression graph are bound to the circuits of one execution, so the
+//contexts must not outlive a Reset() of the party.
+struct party_contexts{
+    faby::share_arena arena;
+    faby::constant_pool constants;
+    faby::expression_graph graph;
+    faby::yao_context yao;
+    faby::gmw_context gmw;
+    faby::arithmetic_context arith;
+
+    explicit party_contexts(ABYParty& party)
+    : yao(faby::create_yao_context(party.GetSharings()[S_YAO]->GetCircuitBuildRoutine())),
+      gmw(faby::create_gmw_context(party.GetSharings()[S_BOOL]->GetCircuitBuildRoutine())),
+      arith(faby::create_arithmetic_context(party.GetSharings()[S_ARITH]->GetCircuitBuildRoutine())){}
+};
+
+std::tuple<std::size_t, std::vector<bool>> execute_circuit(
+    ABYParty& party,
+    Circuit*,
+    e_role role,
+    algorithm alg,
+    doodle_table_view const& dt
+){
+    trace_span const span("execute_circuit");
+    uint32_t best_column;
+    {
+        party_contexts ctx(party);
+        phase_execution column_sums_phase(party, circuit_phase::column_sums);
+        share* col = put_column_sum_circuit(role, alg, dt);
+        column_sums_phase.execute();
+        best_column = col->template get_clear_value<uint32_t>();
+        party.Reset();
+    }
+
+    party_contexts ctx(party);
+    phase_execution no_retrieval(party, circuit_phase::no_retrieval);
+    std::vector<share*> nos = put_no_outputs(role, alg, dt, best_column);
+    no_retrieval.execute();
+
+    return std::make_tuple(best_column, get_no_selections(role, nos));
+}
+
+std::vector<std::tuple<std::size_t, std::vector<bool>>> execute_circuit_batch(
+    ABYParty& party,
+    Circuit*,
+    e_role role,
+    algorithm alg,
+    std::vector<doodle_table_view> const& dts
+){
+    trace_span const span("execute_circuit_batch");
+
+    //the subcircuits of the polls are independent of each other, so they
+    //are evaluated in the same rounds of a single execution
+    std::vector<uint32_t> best_columns;
+    best_columns.reserve(dts.size());
+    {
+        party_contexts ctx(party);
+        phase_execution column_sums_phase(party, circuit_phase::column_sums);
+        std::vector<share*> cols;
+        cols.reserve(dts.size());
+        for(auto const& dt : dts){
+            cols.emplace_back(put_column_sum_circuit(role, alg, dt));
+        }
+        column_sums_phase.execute();
+        for(share* col : cols){
+            best_columns.emplace_back(col->template get_clear_value<uint32_t>());
+        }
+        party.Reset();
+    }
+
+    party_contexts ctx(party);
+    phase_execution no_retrieval(party, circuit_phase::no_retrieval);
+    std::vector<std::vector<share*>> nos;
+    nos.reserve(dts.size());
+    for(std::size_t i = 0; i < dts.size(); ++i){
+        nos.emplace_back(put_no_outputs(role, alg, dts[i], best_columns[i]));
+    }
+    no_retrieval.execute();
+
+    std::vector<std::tuple<std::size_t, std::vector<bool>>> results;
+    results.reserve(dts.size());
+    for(std::size_t i = 0; i < dts.size(); ++i){
+        results.emplace_back(best_columns[i], get_no_selections(role, nos[i]));
+    }
+    return results;
+}
+
+char const* circuit_stage_name(circuit_stage const stage){
+    switch(stage){
+    case circuit_stage::input: return "input";
+    case circuit_stage::column_sums: return "column_sums";
+    case circuit_stage::argmin: return "argmin";
+    case circuit_stage::no_outputs: return "no_outputs";
+    }
+    return "";
+}
+
+namespace{
+
+circuit_report*& current_report(){
+    static thread_local circuit_report* current = nullptr;
+    return current;
+}
+
+}
+
+circuit_report::circuit_report(ABYParty& party)
+: party_(party),
+  previous_(current_report()),
+  census_(std::make_unique<faby::share_census>()),
+  counted_(count_gates_()),
+  stages_(static_cast<std::size_t>(circuit_stage::no_outputs) + 1){
+    current_report() = this;
+    //gates recorded in an expression graph are only put later, they still
+    //count for the stage they were recorded in
+    previous_observer_ = faby::expression_graph::observe_scopes([](uint32_t const scope){
+        enter(static_cast<circuit_stage>(scope));
+    });
+}
+
+circuit_report::~circuit_report(){
+    faby::expression_graph::observe_scopes(previous_observer_);
+    current_report() = previous_;
+}
+
+std::vector<circuit_stage_stats> const& circuit_report::stages(){
+    close_stage_();
+    return stages_;
+}
+
+circuit_stage circuit_report::enter(circuit_stage const stage){
+    faby::expression_graph::set_scope(static_cast<uint32_t>(stage));
+    circuit_report* const report = current_report();
+    if(report == nullptr){
+        return circuit_stage::input;
+    }
+    circuit_stage const previous = report->stage_;
+    if(stage != previous){
+        report->close_stage_();
+        report->stage_ = stage;
+    }
+    return previous;
+}
+
+circuit_report::gate_counts circuit_report::count_gates_() const{
+    std::vector<Sharing*>& sharings = party_.GetSharings();
+    auto* const gmw = static_cast<BooleanCircuit*>(sharings[S_BOOL]->GetCircuitBuildRoutine());
+    auto* const yao = static_cast<BooleanCircuit*>(sharings[S_YAO]->GetCircuitBuildRoutine());
+    auto* const arith = static_cast<ArithmeticCircuit*>(sharings[S_ARITH]->GetCircuitBuildRoutine());
+    gate_counts counts;
+    counts.gmw_gates = gmw->GetNumGates();
+    counts.yao_gates = yao->GetNumGates();
+    counts.arith_gates = arith->GetNumGates();
+    counts.and_gates = uint64_t(gmw->GetNumANDGates()) + yao->GetNumANDGates();
+    counts.mul_gates = arith->GetNumMULGates();
+    counts.wires = party_.GetTotalGates();
+    return counts;
+}
+
+void circuit_report::close_stage_(){
+    gate_counts const counts = count_gates_();
+    circuit_stage_stats& stats = stages_[static_cast<std::size_t>(stage_)];
+    stats.gmw_gates += counts.gmw_gates - counted_.gmw_gates;
+    stats.yao_gates += counts.yao_gates - counted_.yao_gates;
+    stats.arith_gates += counts.arith_gates - counted_.arith_gates;
+    stats.and_gates += counts.and_gates - counted_.and_gates;
+    stats.mul_gates += counts.mul_gates - counted_.mul_gates;
+    stats.wires += counts.wires - counted_.wires;
+    counted_ = counts;
+    std::vector<Sharing*>& sharings = party_.GetSharings();
+    stats.and_depth = std::max(
+        sharings[S_BOOL]->GetCircuitBuildRoutine()->GetMaxDepth(),
+        sharings[S_YAO]->GetCircuitBuildRoutine()->GetMaxDepth()
+    );
+    //the census is emptied with every switch, so it only holds the counts
+    //of the stage being closed
+    stats.input_bits += census_->input_bits;
+    census_->input_bits = 0;
+    for(auto const& c : census_->conversions){
+        stats.conversions[c.first] += c.second;
+    }
+    census_->conversions.clear();
+    for(auto const& w : census_->bit_widths){
+        stats.bit_widths[w.first] += w.second;
+    }
+    census_->bit_widths.clear();
+}
+
+void write_circuit_report(std::ostream& os, std::vector<circuit_stage_stats> const& stages){
+    os << '[';
+    for(std::size_t i = 0; i < stages.size(); ++i){
+        circuit_stage_stats const& s = stages[i];
+        os << (i == 0 ? "" : ", ")
+           << "{\"stage\": \"" << circuit_stage_name(static_cast<circuit_stage>(i)) << '"'
+           << ", \"gates\": {\"gmw\": " << s.gmw_gates << ", \"yao\": " << s.yao_gates << ", \"arith\": " << s.arith_gates << '}'
+           << ", \"and_gates\": " << s.and_gates
+           << ", \"mul_gates\": " << s.mul_gates
+           << ", \"wires\": " << s.wires
+           << ", \"input_bits\": " << s.input_bits
+           << ", \"and_depth\": " << s.and_depth
+           << ", \"conversions\": {";
+        for(auto it = s.conversions.begin(); it != s.conversions.end(); ++it){
+            os << (it == s.conversions.begin() ? "" : ", ") << '"' << it->first << "\": " << it->second;
+        }
+        os << "}, \"bit_widths\": {";
+        for(auto it = s.bit_widths.begin(); it != s.bit_widths.end(); ++it){
+            os << (it == s.bit_widths.begin() ? "" : ", ") << '"' << it->first << "\": " << it->second;
+        }
+        os << "}}";
+    }
+    os << ']';
+}
+
+//intermediate results are carried between executions as XOR shares
+inline share* put_shared_carry(faby::gmw_share s){
+    return faby::shared_output(s).get_share();
+}
+
+inline share* put_shared_carry(faby::yao_share s){
+    return faby::shared_output(faby::gmw_share(s)).get_share();
+}
+
+//a shared output together with the maximum value of the shared value
+struct carried_share{
+    share* s;
+    uint64_t max_val;
+};
+
+template<typename Share>
+carried_share carry(Share s){
+    return carried_share{put_shared_carry(s), s.get_max_val()};
+}
+
+//reads the own shares of the carried values after the execution
+std::vector<shared_value> read_carried(std::vector<carried_share> const& carried){
+    std::vector<shared_value> result;
+    result.reserve(carried.size());
+    for(auto const& cs : carried){
+        result.emplace_back(shared_value{cs.s->template get_clear_value<uint64_t>(), cs.max_val});
+    }
+    return result;
+}
+
+//puts a value carried from an earlier execution back into the circuit
+template<typename CarryInput>
+auto put_carried(CarryInput const& carry_input, shared_value const& sv){
+    return carry_input(sv.share, faby::bitlen_of_max_val(sv.max_val), sv.max_val);
+}
+
+//leaf of the argmin tree over the column sums, i.e. the index of the column
+//and the number of nos and no-maybes packed into one value
+constexpr struct{
+    template<typename Tuple>
+    auto operator()(Tuple&& sum, std::size_t idx) const{
+        using circuit_t = typename std::decay_t<decltype(std::get<0>(sum))>::circuit_t;
+        return std::make_tuple(
+            faby::cons_input<circuit_t>(idx),
+            faby::concat(std::get<0>(sum), std::get<1>(sum))
+        );
+    }
+} argmin_leaf;
+
+//leaf of the top-k selection over the column sums, i.e. a list holding the
+//index of the column and its key. The index is appended to the sums in the
+//key, so that ties are broken in favour of the lower index as in select_min.
+struct top_k_leaf{
+    std::size_t num_columns;
+
+    template<typename Tuple>
+    auto operator()(Tuple&& sum, std::size_t idx) const{
+        using share_t = std::decay_t<decltype(std::get<0>(sum))>;
+        using circuit_t = typename share_t::circuit_t;
+        uint64_t const max_idx = std::max<std::size_t>(num_columns, 2) - 1;
+        share_t const index = faby::cons_input<circuit_t>(idx, faby::bitlen_of_max_val(max_idx), max_idx);
+        return std::vector<std::tuple<share_t, share_t>>{
+            std::make_tuple(index, faby::concat(faby::concat(std::get<0>(sum), std::get<1>(sum)), index))
+        };
+    }
+};
+
+//outputs the indices of the k columns with the smallest sums, best first
+template<typename ColumnSums>
+std::vector<share*> put_ranking(ColumnSums const& column_sums, std::size_t const k){
+    using namespace faby;
+    std::vector<share*> result;
+    if(k <= 1){
+        result.emplace_back(output(std::get<0>(tree_accumulate(column_sums, select_min, argmin_leaf)), ALL));
+        return result;
+    }
+    std::size_t const num_columns = column_sums.end() - column_sums.begin();
+    auto ranking = tree_accumulate(column_sums, select_top_k{k}, top_k_leaf{num_columns});
+    for(auto& t : ranking){
+        result.emplace_back(output(std::get<0>(t), ALL));
+    }
+    return result;
+}
+
+std::vector<uint32_t> get_ranking(std::vector<share*> const& ranking){
+    std::vector<uint32_t> columns;
+    columns.reserve(ranking.size());
+    for(share* s : ranking){
+        columns.emplace_back(s->template get_clear_value<uint32_t>());
+    }
+    return columns;
+}
+
+//retrieves the no-sayers of all columns in one execution, put_nos(col)
+//puts the outputs of the no-sayers of column col
+template<typename PutNos>
+std::vector<std::tuple<std::size_t, std::vector<bool>>> execute_no_retrieval(
+    ABYParty& party,
+    e_role role,
+    std::vector<uint32_t> const& columns,
+    PutNos const& put_nos
+){
+    party_contexts ctx(party);
+    phase_execution no_retrieval(party, circuit_phase::no_retrieval);
+    std::vector<std::vector<share*>> nos;
+    nos.reserve(columns.size());
+    for(uint32_t const col : columns){
+        nos.emplace_back(put_nos(col));
+    }
+    no_retrieval.execute();
+    std::vector<std::tuple<std::size_t, std::vector<bool>>> results;
+    results.reserve(columns.size());
+    for(std::size_t i = 0; i < columns.size(); ++i){
+        results.emplace_back(columns[i], get_no_selections(role, nos[i]));
+    }
+    return results;
+}
+
+//Every shard party evaluates a block of the table. If the table is split by
+//columns, the shards determine the best column of their block and only these
+//candidates are merged, otherwise the shards compute partial column sums of
+//their rows which are added up before the argmin in the merging circuit.
+//MakeInputFunction creates the input policy of a block of rows,
+//CarryInput reads back the carried XOR shares in the merging circuit.
+template<typename MakeInputFunction, typename CarryInput>
+uint32_t execute_sharded_argmin(
+    ABYParty& party,
+    std::vector<ABYParty*> const& shard_parties,
+    doodle_table_view const& dt,
+    MakeInputFunction const& make_input_function,
+    CarryInput const& carry_input
+){
+    using namespace faby;
+    assert(!shard_parties.empty());
+    std::size_t const num_shards = shard_parties.size();
+    std::size_t column_blocks = 1, row_blocks = 1;
+    if(dt.num_columns >= 2 * num_shards){
+        column_blocks = num_shards;
+    }
+    else{
+        row_blocks = std::min(num_shards, dt.num_rows);
+    }
+    auto block_begin = [](std::size_t size, std::size_t blocks, std::size_t b){
+        return size * b / blocks;
+    };
+
+    //faby contexts are per thread, so every shard builds and executes its
+    //circuit on its own thread
+    std::vector<std::vector<shared_value>> values(row_blocks * column_blocks);
+    auto evaluate_block = [&](std::size_t const k){
+        std::size_t const r = k / column_blocks, c = k % column_blocks;
+        std::size_t const first_column = block_begin(dt.num_columns, column_blocks, c);
+        std::size_t const last_column = block_begin(dt.num_columns, column_blocks, c + 1);
+        doodle_table_view const block = dt.rows(
+            block_begin(dt.num_rows, row_blocks, r),
+            block_begin(dt.num_rows, row_blocks, r + 1)
+        );
+        party_contexts ctx(*shard_parties[k]);
+        phase_execution column_sums_phase(*shard_parties[k], circuit_phase::column_sums);
+        std::vector<carried_share> carried;
+        auto const input_function = make_input_function(block);
+        auto column_sums = boost::counting_range(first_column, last_column)
+            | boost::adaptors::transformed([&](std::size_t col){
+                return tree_accumulate(block.column(col), add_column_sums, input_function);
+            });
+        if(row_blocks == 1){
+            auto const candidate = tree_accumulate(
+                column_sums,
+                select_min,
+                [&](auto&& sum, std::size_t idx){
+                    return argmin_leaf(sum, first_column + idx);
+                }
+            );
+            carried.emplace_back(carry(std::get<0>(candidate)));
+            carried.emplace_back(carry(std::get<1>(candidate)));
+        }
+        else{
+            for(auto const& sum : column_sums){
+                carried.emplace_back(carry(std::get<0>(sum)));
+                carried.emplace_back(carry(std::get<1>(sum)));
+            }
+        }
+        column_sums_phase.execute();
+        values[k] = read_carried(carried);
+        shard_parties[k]->Reset();
+    };
+    //an exception of a shard is rethrown once all shards are done, as on
+    //the worker thread it would terminate the server
+    std::vector<std::exception_ptr> errors(values.size());
+    std::vector<std::thread> executions;
+    executions.reserve(values.size());
+    for(std::size_t k = 0; k < values.size(); ++k){
+        executions.emplace_back([&, k]{
+            try{
+                evaluate_block(k);
+            }
+            catch(...){
+                errors[k] = std::current_exception();
+            }
+        });
+    }
+    for(auto& t : executions){
+        t.join();
+    }
+    for(std::exception_ptr const& error : errors){
+        if(error){
+            std::rethrow_exception(error);
+        }
+    }
+
+    party_contexts ctx(party);
+    phase_execution merge(party, circuit_phase::column_sums);
+    using share_t = std::decay_t<decltype(put_carried(carry_input, shared_value{}))>;
+    std::vector<std::tuple<share_t, share_t>> leaves;
+    if(row_blocks == 1){
+        for(auto const& shard : values){
+            leaves.emplace_back(put_carried(carry_input, shard[0]), put_carried(carry_input, shard[1]));
+        }
+    }
+    else{
+        for(std::size_t col = 0; col < dt.num_columns; ++col){
+            auto const sum = tree_accumulate(
+                boost::counting_range(std::size_t(0), row_blocks),
+                add_column_sums,
+                [&](std::size_t r){
+                    return std::make_tuple(
+                        put_carried(carry_input, values[r][2*col]),
+                        put_carried(carry_input, values[r][2*col + 1])
+                    );
+                }
+            );
+            leaves.emplace_back(argmin_leaf(sum, col));
+        }
+    }
+    share* col = output(std::get<0>(tree_accumulate(leaves, select_min)), ALL);
+    merge.execute();
+    uint32_t const best_column = col->template get_clear_value<uint32_t>();
+    party.Reset();
+    return best_column;
+}
+
+std::tuple<std::size_t, std::vector<bool>> execute_circuit_sharded(
+    ABYParty& party,
+    std::vector<ABYParty*> const& shard_parties,
+    e_role role,
+    algorithm alg,
+    doodle_table_view const& dt
+){
+    trace_span const span("execute_circuit_sharded");
+    uint32_t best_column = 0;
+    if(alg == algorithm::gmw){
+        best_column = execute_sharded_argmin(
+            party, shard_parties, dt,
+            [](doodle_table_view const&){ return non_weighted<gmw_input>{}; },
+            gmw_input{}
+        );
+    }
+    else if(alg == algorithm::yao){
+        best_column = execute_sharded_argmin(
+            party, shard_parties, dt,
+            [role](doodle_table_view const&){ return non_weighted<yao_input>{role}; },
+            yao_input{role}
+        );
+    }
+    else if(alg == algorithm::gmw_weighted){
+        best_column = execute_sharded_argmin(
+            party, shard_parties, dt,
+            [](doodle_table_view const& block){ return weighted<gmw_input>{block}; },
+            gmw_input{}
+        );
+    }
+    else if(alg == algorithm::yao_weighted){
+        best_column = execute_sharded_argmin(
+            party, shard_parties, dt,
+            [role](doodle_table_view const& block){ return weighted<yao_input>{block, role}; },
+            yao_input{role}
+        );
+    }
+
+    party_contexts ctx(party);
+    phase_execution no_retrieval(party, circuit_phase::no_retrieval);
+    std::vector<share*> nos = put_no_outputs(role, alg, dt, best_column);
+    no_retrieval.execute();
+    return std::make_tuple(best_column, get_no_selections(role, nos));
+}
+
+//Evaluates the table in chunks of chunk_rows rows, one execution per chunk.
+//The column sums of the chunks evaluated so far are carried to the next
+//execution, the last execution determines the best column.
+template<typename MakeInputFunction, typename CarryInput>
+uint32_t execute_chunked_argmin(
+    ABYParty& party,
+    doodle_table_view const& dt,
+    std::size_t const chunk_rows,
+    MakeInputFunction const& make_input_function,
+    CarryInput const& carry_input
+){
+    using namespace faby;
+    assert(chunk_rows > 0);
+    std::vector<shared_value> sums;
+    for(std::size_t first = 0; ; first += chunk_rows){
+        std::size_t const last = std::min(first + chunk_rows, dt.num_rows);
+        doodle_table_view const chunk = dt.rows(first, last);
+        party_contexts ctx(party);
+        phase_execution column_sums_phase(party, circuit_phase::column_sums);
+        auto const input_function = make_input_function(chunk);
+        auto column_sums = boost::counting_range(std::size_t(0), dt.num_columns)
+            | boost::adaptors::transformed([&](std::size_t col){
+                auto const sum = tree_accumulate(chunk.column(col), add_column_sums, input_function);
+                if(sums.empty()){
+                    return sum;
+                }
+                return add_column_sums(
+                    std::make_tuple(put_carried(carry_input, sums[2*col]), put_carried(carry_input, sums[2*col + 1])),
+                    sum
+                );
+            });
+        if(last == dt.num_rows){
+            share* col = output(std::get<0>(tree_accumulate(column_sums, select_min, argmin_leaf)), ALL);
+            column_sums_phase.execute();
+            uint32_t const best_column = col->template get_clear_value<uint32_t>();
+            party.Reset();
+            return best_column;
+        }
+        std::vector<carried_share> carried;
+        carried.reserve(2 * dt.num_columns);
+        for(auto const& sum : column_sums){
+            carried.emplace_back(carry(std::get<0>(sum)));
+            carried.emplace_back(carry(std::get<1>(sum)));
+        }
+        column_sums_phase.execute();
+        sums = read_carried(carried);
+        party.Reset();
+    }
+}
+
+std::tuple<std::size_t, std::vector<bool>> execute_circuit_chunked(
+    ABYParty& party,
+    e_role role,
+    algorithm alg,
+    doodle_table_view const& dt,
+    std::size_t const chunk_rows
+){
+    trace_span const span("execute_circuit_chunked");
+    uint32_t best_column = 0;
+    if(alg == algorithm::gmw){
+        best_column = execute_chunked_argmin(
+            party, dt, chunk_rows,
+            [](doodle_table_view const&){ return non_weighted<gmw_input>{}; },
+            gmw_input{}
+        );
+    }
+    else if(alg == algorithm::yao){
+        best_column = execute_chunked_argmin(
+            party, dt, chunk_rows,
+            [role](doodle_table_view const&){ return non_weighted<yao_input>{role}; },
+            yao_input{role}
+        );
+    }
+    else if(alg == algorithm::gmw_weighted){
+        best_column = execute_chunked_argmin(
+            party, dt, chunk_rows,
+            [](doodle_table_view const& chunk){ return weighted<gmw_input>{chunk}; },
+            gmw_input{}
+        );
+    }
+    else if(alg == algorithm::yao_weighted){
+        best_column = execute_chunked_argmin(
+            party, dt, chunk_rows,
+            [role](doodle_table_view const& chunk){ return weighted<yao_input>{chunk, role}; },
+            yao_input{role}
+        );
+    }
+
+    //the no-sayers are retrieved in chunks as well
+    std::vector<bool> no_selections;
+    for(std::size_t first = 0; first < dt.num_rows; first += chunk_rows){
+        party_contexts ctx(party);
+        phase_execution no_retrieval(party, circuit_phase::no_retrieval);
+        std::vector<share*> nos = put_no_outputs(
+            role, alg, dt.rows(first, std::min(first + chunk_rows, dt.num_rows)), best_column
+        );
+        no_retrieval.execute();
+        std::vector<bool> const chunk_selections = get_no_selections(role, nos);
+        no_selections.insert(no_selections.end(), chunk_selections.begin(), chunk_selections.end());
+        party.Reset();
+    }
     return std::make_tuple(best_column, no_selections);
 }
 
+//Updates the column sums carried from the last evaluation by the rows that
+//changed since and determines the best column; without carried sums the
+//column sums of the whole table are computed. The updated sums are carried
+//to the next evaluation in the same execution.
+template<typename MakeInputFunction, typename CarryInput>
+std::vector<uint32_t> execute_incremental_ranking(
+    ABYParty& party,
+    std::size_t const k,
+    std::vector<shared_value>& sums,
+    doodle_table_view const& removed,
+    doodle_table_view const& added,
+    doodle_table_view const& dt,
+    MakeInputFunction const& make_input_function,
+    CarryInput const& carry_input
+){
+    using namespace faby;
+    party_contexts ctx(party);
+    phase_execution column_sums_phase(party, circuit_phase::column_sums);
+    bool const full = sums.empty();
+    auto const table_input = make_input_function(dt);
+    auto const removed_input = make_input_function(removed);
+    auto const added_input = make_input_function(added);
+    auto column_sums = boost::counting_range(std::size_t(0), dt.num_columns)
+        | boost::adaptors::transformed([&](std::size_t col){
+            if(full){
+                return tree_accumulate(dt.column(col), add_column_sums, table_input);
+            }
+            auto sum = std::make_tuple(put_carried(carry_input, sums[2*col]), put_carried(carry_input, sums[2*col + 1]));
+            if(added.num_rows > 0){
+                sum = add_column_sums(sum, tree_accumulate(added.column(col), add_column_sums, added_input));
+            }
+            if(removed.num_rows > 0){
+                auto const sub = tree_accumulate(removed.column(col), add_column_sums, removed_input);
+                sum = std::make_tuple(std::get<0>(sum) - std::get<0>(sub), std::get<1>(sum) - std::get<1>(sub));
+            }
+            //only unweighted polls are evaluated incrementally, so the sums
+            //cannot exceed the number of rows and the carry bits are dropped
+            using share_t = std::decay_t<decltype(std::get<0>(sum))>;
+            uint64_t const max_val = std::max<std::size_t>(dt.num_rows, 1);
+            return std::make_tuple(
+                share_t(std::get<0>(sum).get_share(), max_val),
+                share_t(std::get<1>(sum).get_share(), max_val)
+            );
+        });
+    std::vector<std::decay_t<decltype(*column_sums.begin())>> evaluated(column_sums.begin(), column_sums.end());
+    std::vector<carried_share> carried;
+    carried.reserve(2 * dt.num_columns);
+    for(auto const& sum : evaluated){
+        carried.emplace_back(carry(std::get<0>(sum)));
+        carried.emplace_back(carry(std::get<1>(sum)));
+    }
+    std::vector<share*> const ranking = put_ranking(evaluated, k);
+    column_sums_phase.execute();
+    std::vector<uint32_t> const columns = get_ranking(ranking);
+    sums = read_carried(carried);
+    party.Reset();
+    return columns;
+}
+
+std::vector<std::tuple<std::size_t, std::vector<bool>>> execute_circuit_incremental(
+    ABYParty& party,
+    e_role role,
+    algorithm alg,
+    std::size_t const k,
+    std::vector<shared_value>& sums,
+    doodle_table_view const& removed,
+    doodle_table_view const& added,
+    doodle_table_view const& dt
+){
+    trace_span const span("execute_circuit_incremental");
+    std::vector<uint32_t> columns;
+    if(alg == algorithm::gmw){
+        columns = execute_incremental_ranking(
+            party, k, sums, removed, added, dt,
+            [](doodle_table_view const&){ return non_weighted<gmw_input>{}; },
+            gmw_input{}
+        );
+    }
+    else if(alg == algorithm::yao){
+        columns = execute_incremental_ranking(
+            party, k, sums, removed, added, dt,
+            [role](doodle_table_view const&){ return non_weighted<yao_input>{role}; },
+            yao_input{role}
+        );
+    }
+    else{
+        throw std::invalid_argument("weighted polls are not evaluated incrementally");
+    }
+
+    return execute_no_retrieval(party, role, columns, [&](uint32_t col){
+        return put_no_outputs(role, alg, dt, col);
+    });
+}
+
+std::vector<std::tuple<std::size_t, std::vector<bool>>> execute_circuit_additive(
+    ABYParty& party,
+    e_role role,
+    std::size_t const k,
+    additive_column_sums const& sums,
+    doodle_table_view const& dt
+){
+    trace_span const span("execute_circuit_additive");
+    using namespace faby;
+    std::vector<uint32_t> columns;
+    {
+        party_contexts ctx(party);
+        phase_execution column_sums_phase(party, circuit_phase::column_sums);
+        additive_yao_input const input(role);
+        uint64_t const max_val = std::max<std::size_t>(sums.num_rows, 1);
+        auto column_sums = boost::counting_range(std::size_t(0), sums.nos.size())
+            | boost::adaptors::transformed([&](std::size_t col){
+                return std::make_tuple(input(sums.nos[col], 32u, max_val), input(sums.no_maybes[col], 32u, max_val));
+            });
+        std::vector<share*> const ranking = put_ranking(column_sums, k);
+        column_sums_phase.execute();
+        columns = get_ranking(ranking);
+        party.Reset();
+    }
+    return execute_no_retrieval(party, role, columns, [&](uint32_t col){
+        return retrieve_nos(dt, col, get_additive_no<::yao_input>{role});
+    });
+}
+
+std::vector<std::tuple<std::size_t, std::vector<bool>>> execute_circuit_top_k(
+    ABYParty& party,
+    e_role role,
+    algorithm alg,
+    doodle_table_view const& dt,
+    std::size_t const k
+){
+    trace_span const span("execute_circuit_top_k");
+    using namespace faby;
+    std::vector<uint32_t> columns;
+    {
+        party_contexts ctx(party);
+        phase_execution column_sums_phase(party, circuit_phase::column_sums);
+        auto put_sums = [&](auto const& input_function){
+            auto column_sums = boost::counting_range(std::size_t(0), dt.num_columns)
+                | boost::adaptors::transformed([&](std::size_t col){
+                    return tree_accumulate(dt.column(col), add_column_sums, input_function);
+                });
+            return put_ranking(column_sums, k);
+        };
+        std::vector<share*> ranking;
+        if(alg == algorithm::gmw){
+            ranking = put_sums(non_weighted<::gmw_input>{});
+        }
+        else if(alg == algorithm::yao){
+            ranking = put_sums(non_weighted<::yao_input>{role});
+        }
+        else if(alg == algorithm::gmw_weighted){
+            ranking = put_sums(weighted<::gmw_input>{dt});
+        }
+        else if(alg == algorithm::yao_weighted){
+            ranking = put_sums(weighted<::yao_input>{dt, role});
+        }
+        column_sums_phase.execute();
+        columns = get_ranking(ranking);
+        party.Reset();
+    }
+    return execute_no_retrieval(party, role, columns, [&](uint32_t col){
+        return put_no_outputs(role, alg, dt, col);
+    });
+}
+
+uint64_t agree_next_poll(ABYParty& party, Circuit* circ, e_role role, uint64_t poll_id){
+    trace_span const span("agree_next_poll");
+    faby::share_arena arena;
+    auto yao_ctx = faby::create_yao_context(circ);
+    faby::yao_share id = role == SERVER ?
+        faby::yao_input(poll_id, 64u, SERVER)
+        : faby::yao_dummy_input(64u);
+    share* agreed = faby::output(id, ALL);
+    party.ExecCircuit();
+    uint64_t const result = agreed->template get_clear_value<uint64_t>();
+    party.Reset();
+    return result;
+}
+
+uint64_t estimate_circuit_cost(
+    algorithm alg,
+    std::size_t summed_rows,
+    std::size_t num_rows,
+    std::size_t num_columns,
+    std::size_t max_weight
+){
+    bool const is_weighted = alg == algorithm::gmw_weighted || alg == algorithm::yao_weighted;
+    uint64_t const weight_bits = is_weighted ? faby::bitlen_of_max_val(std::max<std::size_t>(max_weight, 1)) : 1;
+    uint64_t const sum_bits = faby::bitlen_of_max_val(std::max<std::size_t>(num_rows, 1) * (is_weighted ? max_weight : 1));
+    //both column sums are added up over the rows, the argmin compares and
+    //selects the packed sums once per column and the no-sayers are one
+    //reconstruction per row
+    return 2 * uint64_t(summed_rows) * num_columns * weight_bits
+        + 3 * 2 * sum_bits * num_columns
+        + num_rows;
+}
+
+execution_stats benchmark_circuit(
+    ABYParty& party,
+    e_role role,
+    algorithm alg,
+    doodle_table_view const& dt,
+    doodle_table_view const& clear_dt
+){
+    execution_stats stats;
+    e_sharing const sh = alg == algorithm::gmw || alg == algorithm::gmw_weighted ? S_BOOL : S_YAO;
+    auto add_execution = [&]{
+        stats.setup_ms += party.GetTiming(P_SETUP);
+        stats.online_ms += party.GetTiming(P_ONLINE);
+        stats.sent_bytes += party.GetSentData(P_SETUP) + party.GetSentData(P_ONLINE);
+        stats.received_bytes += party.GetReceivedData(P_SETUP) + party.GetReceivedData(P_ONLINE);
+        stats.rounds += party.GetSharings()[sh]->GetMaxCommunicationRounds();
+        stats.phase_rss_bytes = std::max(stats.phase_rss_bytes, read_memory_usage().rss_bytes);
+    };
+    uint32_t best_column;
+    {
+        party_contexts ctx(party);
+        share* const col = put_column_sum_circuit(role, alg, dt);
+        party.ExecCircuit();
+        add_execution();
+        best_column = col->template get_clear_value<uint32_t>();
+        party.Reset();
+    }
+    std::vector<bool> no_selections;
+    {
+        party_contexts ctx(party);
+        std::vector<share*> const nos = put_no_outputs(role, alg, dt, best_column);
+        party.ExecCircuit();
+        add_execution();
+        no_selections = get_no_selections(role, nos);
+        party.Reset();
+    }
+    if(clear_dt.num_columns != 0){
+        //the plain circuit breaks ties like the circuit of alg
+        circuit_simulation const expected = simulate_circuit(alg, clear_dt);
+        stats.checked = true;
+        stats.correct = best_column == expected.best_column && (role != SERVER || no_selections == expected.nos);
+    }
+    return stats;
+}
+
+void run_both_roles(std::function<void(e_role)> const& f, std::chrono::milliseconds const grace){
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::exception_ptr errors[2];
+    bool done[2] = {false, false};
+    auto run = [&](e_role const r){
+        std::exception_ptr error;
+        try{
+            f(r);
+        }
+        catch(...){
+            error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        errors[r] = error;
+        done[r] = true;
+        finished.notify_all();
+    };
+    std::thread server(run, SERVER);
+    std::thread client(run, CLIENT);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&]{
+            return (done[SERVER] && done[CLIENT]) || errors[SERVER] || errors[CLIENT];
+        });
+        //the peer of a failed role may wait for it inside ABY, which cannot be
+        //interrupted, and the peer still uses what f refers to, so neither
+        //joining nor abandoning its thread is safe
+        if(!finished.wait_for(lock, grace, [&]{ return done[SERVER] && done[CLIENT]; })){
+            e_role const failed = errors[SERVER] ? SERVER : CLIENT;
+            std::string what = "unknown error";
+            try{
+                std::rethrow_exception(errors[failed]);
+            }
+            catch(std::exception const& e){
+                what = e.what();
+            }
+            catch(...){}
+            std::cerr << "error: " << (failed == SERVER ? "server" : "client") << " failed: " << what
+                      << ", its peer did not stop within " << grace.count() << " ms" << std::endl;
+            std::_Exit(EXIT_FAILURE);
+        }
+    }
+    server.join();
+    client.join();
+    for(std::exception_ptr const& error : errors){
+        if(error){
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+std::vector<std::string> const& circuit_variants(){
+    static std::vector<std::string> const variants{
+        "gmw", "yao", "gmw_weighted", "yao_weighted",
+        "gmw_hybrid", "yao_hybrid", "gmw_weighted_hybrid", "yao_weighted_hybrid",
+        "arith_gmw", "arith_yao", "gmw_arith_yao"
+    };
+    return variants;
+}
+
+construction_stats measure_construction(
+    ABYParty& party,
+    e_role role,
+    std::string const& variant,
+    std::size_t rows,
+    std::size_t columns,
+    uint32_t seed,
+    bool const gate_stats
+){
+    bool const is_arithmetic = variant.compare(0, 6, "arith_") == 0;
+    doodle_table dt, alice_dt, bob_dt;
+    std::tie(dt, alice_dt, bob_dt) = generate_tables(rows, columns, is_arithmetic, seed);
+    return measure_construction(party, role, variant, role == SERVER ? bob_dt : alice_dt, gate_stats);
+}
+
+construction_stats measure_construction(
+    ABYParty& party,
+    e_role role,
+    std::string const& variant,
+    doodle_table_view const& own_dt,
+    bool const gate_stats
+){
+    using clock = std::chrono::steady_clock;
+    auto ms_since = [](clock::time_point const start){
+        return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    };
+    construction_stats stats;
+    {
+        party_contexts ctx(party);
+        std::unique_ptr<circuit_report> report;
+        if(gate_stats){
+            report = std::make_unique<circuit_report>(party);
+        }
+        //the no-sayers are retrieved for the first column, as the best one is
+        //only known after an execution
+        auto measure = [&](auto const& make_input, auto const& no_input, auto const& conv){
+            clock::time_point start = clock::now();
+            auto const input = make_input();
+            stats.input_ms = ms_since(start);
+            start = clock::now();
+            buildColumnSumCircuit(own_dt, input, conv);
+            stats.column_sums_ms = ms_since(start);
+            start = clock::now();
+            retrieve_nos(own_dt, 0, no_input);
+            stats.no_retrieval_ms = ms_since(start);
+        };
+        if(variant == "gmw"){
+            measure([&]{ return non_weighted<gmw_input>{}; }, get_no<gmw_input>{}, gmw_input::get_conversion());
+        }
+        else if(variant == "yao"){
+            measure([&]{ return non_weighted<yao_input>{role}; }, get_no<yao_input>{role}, yao_input::get_conversion());
+        }
+        else if(variant == "gmw_weighted"){
+            measure([&]{ return weighted<gmw_input>{own_dt}; }, get_no<gmw_input>{}, gmw_input::get_conversion());
+        }
+        else if(variant == "yao_weighted"){
+            measure([&]{ return weighted<yao_input>{own_dt, role}; }, get_no<yao_input>{role}, yao_input::get_conversion());
+        }
+        else if(variant == "gmw_hybrid"){
+            measure([&]{ return arith_hybrid<non_weighted<gmw_input>>{}; }, get_no<gmw_input>{}, gmw_input::get_conversion());
+        }
+        else if(variant == "yao_hybrid"){
+            measure([&]{ return arith_hybrid<non_weighted<yao_input>>{role}; }, get_no<yao_input>{role}, yao_input::get_conversion());
+        }
+        else if(variant == "gmw_weighted_hybrid"){
+            measure([&]{ return arith_hybrid<weighted<gmw_input>>{own_dt}; }, get_no<gmw_input>{}, gmw_input::get_conversion());
+        }
+        else if(variant == "yao_weighted_hybrid"){
+            measure(
+                [&]{ return arith_hybrid<weighted<yao_input>>{own_dt, role}; },
+                get_no<yao_input>{role},
+                yao_input::get_conversion()
+            );
+        }
+        else if(variant == "arith_gmw"){
+            measure([&]{ return non_weighted<arith_input>{}; }, get_no<arith_input>{}, arithmetic_to<faby::gmw_share>{});
+        }
+        else if(variant == "arith_yao"){
+            measure([&]{ return non_weighted<arith_input>{}; }, get_no<arith_input>{}, arithmetic_to<faby::yao_share>{});
+        }
+        else if(variant == "gmw_arith_yao"){
+            measure([&]{ return arith_hybrid<non_weighted<gmw_input>>{}; }, get_no<gmw_input>{}, arithmetic_to<faby::yao_share>{});
+        }
+        else{
+            throw std::runtime_error("unknown circuit variant " + variant);
+        }
+        stats.gates = party.GetTotalGates();
+        stats.circuit_rss_bytes = read_memory_usage().rss_bytes;
+        if(report){
+            stats.stages = report->stages();
+        }
+    }
+    party.Reset();
+    return stats;
+}
+
+circuit_simulation simulate_circuit(algorithm alg, doodle_table_view const& dt){
+    circuit_simulation result;
+    faby::plain_circuit circ;
+    faby::plain_share col;
+    if(alg == algorithm::gmw || alg == algorithm::yao){
+        col = buildColumnSumCircuit(dt, non_weighted<plain_input>{});
+    }
+    else{
+        col = buildColumnSumCircuit(dt, weighted<plain_input>{dt});
+    }
+    result.best_column = col->template get_clear_value<uint32_t>();
+    result.and_gates = circ.num_and_gates();
+    result.xor_gates = circ.num_xor_gates();
+    result.input_bits = circ.num_input_bits();
+    result.depth = circ.depth();
+    result.nos.reserve(dt.num_rows);
+    for(doodle_entry const de : dt.column(result.best_column)){
+        result.nos.emplace_back(faby::output(get_no<plain_input>{}(de))->template get_clear_value<bool>());
+    }
+    result.no_retrieval_and_gates = circ.num_and_gates() - result.and_gates;
+    result.no_retrieval_xor_gates = circ.num_xor_gates() - result.xor_gates;
+    return result;
+}
+
+std::size_t agree_batch_size(ABYParty& party, Circuit* circ, e_role role, std::size_t batch_size){
+    trace_span const span("agree_batch_size");
+    faby::share_arena arena;
+    auto yao_ctx = faby::create_yao_context(circ);
+    //both parties put the input gates in the same order
+    auto input_of = [&](e_role owner){
+        return owner == role ?
+            faby::yao_input(static_cast<uint64_t>(batch_size), 32u, role)
+            : faby::yao_dummy_input(32u);
+    };
+    faby::yao_share server_size = input_of(SERVER);
+    faby::yao_share client_size = input_of(CLIENT);
+    share* agreed = faby::output(faby::if_else(server_size > client_size, client_size, server_size), ALL);
+    party.ExecCircuit();
+    std::size_t const result = agreed->template get_clear_value<uint32_t>();
+    party.Reset();
+    return result;
+}
+
+void warm_up_party(ABYParty& party, Circuit* circ, e_role role){
+    faby::share_arena arena;
+    auto yao_ctx = faby::create_yao_context(circ);
+    faby::output(yao_input{role}(0u, 1u), ALL);
+    party.ExecCircuit();
+    party.Reset();
+}
+
+int64_t exchange_clock_offset(ABYParty& party, Circuit* circ, e_role role){
+    constexpr std::size_t executions = 9;
+    std::vector<int64_t> offsets;
+    offsets.reserve(executions);
+    for(std::size_t i = 0; i < executions; ++i){
+        warm_up_party(party, circ, role);
+        uint64_t const now = static_cast<uint64_t>(trace_clock_us());
+        faby::share_arena arena;
+        auto yao_ctx = faby::create_yao_context(circ);
+        auto input_of = [&](e_role owner){
+            return owner == role ? faby::yao_input(now, 64u, role) : faby::yao_dummy_input(64u);
+        };
+        share* server_time = faby::output(input_of(SERVER), ALL);
+        share* client_time = faby::output(input_of(CLIENT), ALL);
+        party.ExecCircuit();
+        offsets.emplace_back(static_cast<int64_t>(
+            server_time->template get_clear_value<uint64_t>() - client_time->template get_clear_value<uint64_t>()
+        ));
+        party.Reset();
+    }
+    std::nth_element(offsets.begin(), offsets.begin() + executions / 2, offsets.end());
+    return role == SERVER ? 0 : offsets[executions / 2];
+}
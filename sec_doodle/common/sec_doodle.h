@@ -19,8 +19,14 @@
 #define ABY_SEC_DOODLE_SEC_DOODLE_H_09072017_0743
 
 #include "config.h"
+#include "memory.h"
 
 #include <vector>
+#include <string>
+#include <map>
+#include <memory>
+#include <functional>
+#include <chrono>
 #include <iosfwd>
 #include <type_traits>
 
@@ -28,6 +34,7 @@
 #include <boost/range/adaptor/strided.hpp>
 #include <boost/range/adaptor/sliced.hpp>
 #include <boost/range/adaptor/transformed.hpp>
+#include <boost/range/iterator_range.hpp>
 
 
 #include <abycore/circuit/booleancircuits.h>
@@ -45,7 +52,10 @@ constexpr doodle_entry yes = 0;
 constexpr doodle_entry maybe = 1;
 constexpr doodle_entry no = 3;
 
-struct doodle_table{
+//row and column access shared by doodle_table and doodle_table_view,
+//Table needs the members entries, num_rows and num_columns
+template<typename Table>
+struct basic_doodle_table{
 private:
     template<typename T>
     static decltype(auto) column_(T* dt, std::size_t i) {
@@ -68,7 +78,7 @@ private:
         using boost::counting_range;
         using boost::adaptors::transformed;
             
-        return counting_range(decltype(num_columns)(0), dt->num_columns) 
+        return counting_range(std::size_t(0), dt->num_columns) 
                | transformed([dt](std::size_t i){
                      return dt->column(i);
                  });
@@ -85,72 +95,81 @@ private:
                 return dt->row(i);
             }
         } lambda{dt};
-        return counting_range(decltype(num_rows)(0), dt->num_rows) | transformed(lambda);
+        return counting_range(std::size_t(0), dt->num_rows) | transformed(lambda);
     }
     
-public:
-    std::vector<doodle_entry> entries;
-    std::vector<unsigned int> weights;
-    std::size_t num_rows, num_columns, max_weight;
-    
-    doodle_table() = default;
-    
-    doodle_table(std::vector<doodle_entry> entries, std::size_t num_rows, std::size_t num_columns)
-    : entries(std::move(entries)), num_rows(num_rows), num_columns(num_columns){}
-    
-    doodle_table(
-        std::vector<doodle_entry> entries, 
-        std::vector<unsigned int> weights,
-        std::size_t num_rows, 
-        std::size_t num_columns,
-        std::size_t max_weight
-    ) 
-    : entries(std::move(entries)),
-      weights(std::move(weights)),
-      num_rows(num_rows), 
-      num_columns(num_columns),
-      max_weight(max_weight){}
+    Table* self_(){
+        return static_cast<Table*>(this);
+    }
     
+    Table const* self_() const{
+        return static_cast<Table const*>(this);
+    }
     
+public:
     decltype(auto) column(std::size_t i) {
-        return column_(this, i);
+        return column_(self_(), i);
     }
     
     decltype(auto) column(std::size_t i) const {
-        return column_(this, i);
+        return column_(self_(), i);
     }
     
     decltype(auto) get_columns(){
-        return get_columns_(this);
+        return get_columns_(self_());
     }
     
     decltype(auto) get_columns() const{
-        return get_columns_(this);
+        return get_columns_(self_());
     }
     
     decltype(auto) row(std::size_t i) {
-        return row_(this, i);
+        return row_(self_(), i);
     }
     
     decltype(auto) row(std::size_t i) const{
-        return row_(this, i);
+        return row_(self_(), i);
     }
     
     decltype(auto) get_rows(){
-        return get_rows_(this);
+        return get_rows_(self_());
     }
     
     decltype(auto) get_rows() const{
-        return get_rows_(this);
+        return get_rows_(self_());
     }
     
     std::size_t row_size() const{
-        return num_columns;
+        return self_()->num_columns;
     }
     
     std::size_t column_size() const{
-        return num_rows;
+        return self_()->num_rows;
     }
+};
+
+struct doodle_table : basic_doodle_table<doodle_table>{
+    std::vector<doodle_entry> entries;
+    std::vector<unsigned int> weights;
+    std::size_t num_rows = 0, num_columns = 0, max_weight = 0;
+    
+    doodle_table() = default;
+    
+    doodle_table(std::vector<doodle_entry> entries, std::size_t num_rows, std::size_t num_columns)
+    : entries(std::move(entries)), num_rows(num_rows), num_columns(num_columns){}
+    
+    doodle_table(
+        std::vector<doodle_entry> entries, 
+        std::vector<unsigned int> weights,
+        std::size_t num_rows, 
+        std::size_t num_columns,
+        std::size_t max_weight
+    ) 
+    : entries(std::move(entries)),
+      weights(std::move(weights)),
+      num_rows(num_rows), 
+      num_columns(num_columns),
+      max_weight(max_weight){}
     
     decltype(auto) add_row(){
         entries.resize(entries.size() + num_columns);
@@ -160,8 +179,67 @@ public:
     
 };
 
+//non-owning view of the rows of a table stored contiguously in row-major order
+struct doodle_table_view : basic_doodle_table<doodle_table_view>{
+    boost::iterator_range<doodle_entry const*> entries;
+    boost::iterator_range<unsigned int const*> weights;
+    std::size_t num_rows = 0, num_columns = 0, max_weight = 0;
+    
+    doodle_table_view() = default;
+    
+    doodle_table_view(
+        doodle_entry const* entries,
+        unsigned int const* weights,
+        std::size_t num_rows,
+        std::size_t num_columns,
+        std::size_t max_weight
+    )
+    : entries(entries, entries + num_rows * num_columns),
+      weights(weights, weights == nullptr ? weights : weights + num_rows),
+      num_rows(num_rows),
+      num_columns(num_columns),
+      max_weight(max_weight){}
+    
+    doodle_table_view(doodle_table const& dt)
+    : doodle_table_view(
+        dt.entries.data(), 
+        dt.weights.empty() ? nullptr : dt.weights.data(), 
+        dt.num_rows, 
+        dt.num_columns, 
+        dt.max_weight
+      ){}
+    
+    //view of the rows [first, last)
+    doodle_table_view rows(std::size_t first, std::size_t last) const{
+        return doodle_table_view(
+            entries.begin() + first * num_columns,
+            weights.empty() ? nullptr : weights.begin() + first,
+            last - first,
+            num_columns,
+            max_weight
+        );
+    }
+};
+
 std::ostream& operator<<(std::ostream&, doodle_table const&);
 
+//own XOR share of a value that is carried from one execution to a later one
+//through a shared output and a shared input, max_val is the maximum of the value
+struct shared_value{
+    uint64_t share;
+    uint64_t max_val;
+};
+
+//a random poll of rows participants and columns time slots in clear and
+//shared between the parties (XOR shared or, if is_arithmetic, additively);
+//the same seed yields the same tables
+std::tuple<doodle_table, doodle_table, doodle_table> generate_tables(
+    std::size_t rows,
+    std::size_t columns,
+    bool is_arithmetic,
+    uint32_t seed
+);
+
 int32_t test_sec_doodle_circuit(
     e_role role, 
     char* address, 
@@ -175,12 +253,352 @@ int32_t test_sec_doodle_circuit(
 );
 
 
+//additive shares modulo 2^32 of the column sums of a poll whose entries are
+//additively shared: the upper 32 bits of an entry are the share of "no",
+//the lower 32 bits the share of "no or maybe". As the sums are linear, they
+//are updated locally whenever a ballot arrives.
+struct additive_column_sums{
+    std::vector<uint32_t> nos, no_maybes;
+    std::size_t num_rows = 0;
+    
+    additive_column_sums() = default;
+    
+    explicit additive_column_sums(std::size_t num_columns)
+    : nos(num_columns), no_maybes(num_columns){}
+    
+    template<typename Row>
+    void add(Row const& row){
+        std::size_t i = 0;
+        for(doodle_entry const e : row){
+            nos[i] += static_cast<uint32_t>(e >> 32);
+            no_maybes[i] += static_cast<uint32_t>(e);
+            ++i;
+        }
+        ++num_rows;
+    }
+    
+    template<typename Row>
+    void subtract(Row const& row){
+        std::size_t i = 0;
+        for(doodle_entry const e : row){
+            nos[i] -= static_cast<uint32_t>(e >> 32);
+            no_maybes[i] -= static_cast<uint32_t>(e);
+            ++i;
+        }
+        --num_rows;
+    }
+};
+
+//the executions the evaluation of a poll consists of: computing the best
+//columns (possibly in several executions) and retrieving their no-sayers
+enum struct circuit_phase{
+    column_sums,
+    no_retrieval
+};
+
+//measurements of one execution of the evaluation circuits
+struct phase_execution_stats{
+    circuit_phase phase;
+    //from the start of building the circuit to its execution
+    double build_ms = 0;
+    double setup_ms = 0, online_ms = 0;
+    uint64_t sent_bytes = 0, received_bytes = 0, and_gates = 0;
+    //after the execution, before the circuit is reset
+    memory_usage memory;
+};
+
+//observer is called after every execution of the execute_circuit functions,
+//from the threads executing them, e.g. to export metrics; it is set before
+//any poll is evaluated
+void set_execution_observer(std::function<void(phase_execution_stats const&)> observer);
+
 std::tuple<std::size_t, std::vector<bool>> execute_circuit(
     ABYParty& party, 
     Circuit* circ, 
     e_role role, 
     algorithm sel, 
-    doodle_table const& dt
+    doodle_table_view const& dt
+);
+
+//evaluates several polls side by side in one execution of the party;
+//the i-th result belongs to dts[i]
+std::vector<std::tuple<std::size_t, std::vector<bool>>> execute_circuit_batch(
+    ABYParty& party, 
+    Circuit* circ, 
+    e_role role, 
+    algorithm sel, 
+    std::vector<doodle_table_view> const& dts
 );
 
+//evaluates the poll in executions of chunk_rows rows each, so that the
+//memory needed does not depend on the number of participants; only finds
+//the best column, see execute_circuit_top_k for more
+std::tuple<std::size_t, std::vector<bool>> execute_circuit_chunked(
+    ABYParty& party,
+    e_role role,
+    algorithm sel,
+    doodle_table_view const& dt,
+    std::size_t chunk_rows
+);
+
+//evaluates a large poll on the additional parties in shard_parties in
+//parallel, whose partial results are merged by party; the no-sayers
+//are retrieved by party. Only finds the best column.
+std::tuple<std::size_t, std::vector<bool>> execute_circuit_sharded(
+    ABYParty& party,
+    std::vector<ABYParty*> const& shard_parties,
+    e_role role,
+    algorithm sel,
+    doodle_table_view const& dt
+);
+
+//ranks the k best columns, best first, in one execution and retrieves the
+//no-sayers of all of them in a second one
+std::vector<std::tuple<std::size_t, std::vector<bool>>> execute_circuit_top_k(
+    ABYParty& party,
+    e_role role,
+    algorithm sel,
+    doodle_table_view const& dt,
+    std::size_t k
+);
+
+//evaluates a poll from the XOR shared column sums of its last evaluation:
+//removed holds the rows changed since as they were then, added the current
+//content of the changed and the new rows and dt the whole current table.
+//Without carried sums all column sums are computed from dt. sums is updated
+//to the column sums of dt for the next evaluation. Returns the k best
+//columns, see execute_circuit_top_k. The ballots of a log carry no weights,
+//so sel is algorithm::gmw or algorithm::yao, std::invalid_argument is
+//thrown for the weighted ones.
+std::vector<std::tuple<std::size_t, std::vector<bool>>> execute_circuit_incremental(
+    ABYParty& party,
+    e_role role,
+    algorithm sel,
+    std::size_t k,
+    std::vector<shared_value>& sums,
+    doodle_table_view const& removed,
+    doodle_table_view const& added,
+    doodle_table_view const& dt
+);
+
+//evaluates an additively shared poll from its running column sums, so only
+//the argmin over the columns is computed in the circuit; dt holds the
+//additively shared entries for the retrieval of the no-sayers. Returns the
+//k best columns, see execute_circuit_top_k.
+std::vector<std::tuple<std::size_t, std::vector<bool>>> execute_circuit_additive(
+    ABYParty& party,
+    e_role role,
+    std::size_t k,
+    additive_column_sums const& sums,
+    doodle_table_view const& dt
+);
+
+//both parties learn the id of the poll proposed by the server
+uint64_t agree_next_poll(ABYParty& party, Circuit* circ, e_role role, uint64_t poll_id);
+
+//rough number of non-linear gates of evaluating a poll of num_rows rows of
+//which summed_rows enter the column sums (fewer if the sums are carried over)
+uint64_t estimate_circuit_cost(
+    algorithm alg,
+    std::size_t summed_rows,
+    std::size_t num_rows,
+    std::size_t num_columns,
+    std::size_t max_weight = 0
+);
+
+//runs f(SERVER) and f(CLIENT) on two threads, e.g. to run both parties in
+//one process connected over loopback; an exception of either is rethrown
+//once both returned. If one role fails and the other one has not returned
+//grace later, e.g. as it waits for its peer inside ABY, the process is ended
+//with the error, as the other role can neither be joined nor interrupted.
+void run_both_roles(
+    std::function<void(e_role)> const& f,
+    std::chrono::milliseconds grace = std::chrono::seconds(10)
+);
+
+namespace faby{
+    class share_census;
+}
+
+//the stages of building the circuit of a poll, see circuit_report
+enum struct circuit_stage{
+    input,
+    column_sums,
+    argmin,
+    no_outputs
+};
+
+char const* circuit_stage_name(circuit_stage stage);
+
+//gates put in one stage of building a circuit
+struct circuit_stage_stats{
+    //gates of all types of the GMW, Yao and arithmetic circuits
+    uint64_t gmw_gates = 0, yao_gates = 0, arith_gates = 0;
+    uint64_t and_gates = 0, mul_gates = 0;
+    //gates of all sharings, each is the source of its own output wires
+    uint64_t wires = 0;
+    uint64_t input_bits = 0;
+    //AND depth of the GMW and Yao circuits at the end of the stage
+    uint32_t and_depth = 0;
+    //conversions between sharings by kind, e.g. "y2b"
+    std::map<std::string, uint64_t> conversions;
+    //number of shares by the bit length chosen from their maximum value
+    std::map<uint32_t, uint64_t> bit_widths;
+};
+
+//While it is the innermost report of the calling thread, attributes the
+//gates put in the circuits of party to the stage set by the innermost
+//circuit_stage_scope; gates put outside of any scope count as input. The
+//circuits must not be reset while the report is alive.
+class circuit_report{
+public:
+    explicit circuit_report(ABYParty& party);
+
+    circuit_report(circuit_report const&) = delete;
+    circuit_report& operator=(circuit_report const&) = delete;
+
+    ~circuit_report();
+
+    //stats of all stages, indexed by circuit_stage, up to now
+    std::vector<circuit_stage_stats> const& stages();
+
+    //switches the stage of the current report of the calling thread, if any,
+    //and returns the previous stage
+    static circuit_stage enter(circuit_stage stage);
+
+private:
+    struct gate_counts{
+        uint64_t gmw_gates = 0, yao_gates = 0, arith_gates = 0, and_gates = 0, mul_gates = 0, wires = 0;
+    };
+
+    gate_counts count_gates_() const;
+    //adds the gates put since the last switch to the current stage
+    void close_stage_();
+
+    ABYParty& party_;
+    circuit_report* previous_;
+    //observer of the expression graphs of the enclosing report
+    void (*previous_observer_)(uint32_t);
+    std::unique_ptr<faby::share_census> census_;
+    circuit_stage stage_ = circuit_stage::input;
+    gate_counts counted_;
+    std::vector<circuit_stage_stats> stages_;
+};
+
+//sets the stage of the current circuit_report for its lifetime
+class circuit_stage_scope{
+public:
+    explicit circuit_stage_scope(circuit_stage const stage)
+    : previous_(circuit_report::enter(stage)) {}
+
+    circuit_stage_scope(circuit_stage_scope const&) = delete;
+    circuit_stage_scope& operator=(circuit_stage_scope const&) = delete;
+
+    ~circuit_stage_scope(){
+        circuit_report::enter(previous_);
+    }
+
+private:
+    circuit_stage previous_;
+};
+
+//writes the stages as a JSON array of objects
+void write_circuit_report(std::ostream& os, std::vector<circuit_stage_stats> const& stages);
+
+//time spent building the parts of the circuit of a poll
+struct construction_stats{
+    //construction of the input policy, e.g. the weight inputs of weighted
+    double input_ms = 0;
+    double column_sums_ms = 0;
+    double no_retrieval_ms = 0;
+    uint64_t gates = 0;
+    //resident set size once the whole circuit is built
+    uint64_t circuit_rss_bytes = 0;
+    //see circuit_report, only filled in on request
+    std::vector<circuit_stage_stats> stages;
+};
+
+//names of the combinations of input policy and circuits measure_construction knows
+std::vector<std::string> const& circuit_variants();
+
+//builds the circuit of a random poll for the given variant (see
+//circuit_variants) and discards it again without an execution, so no
+//second party is needed; with gate_stats the gates of its stages are
+//reported, which slows down the construction
+construction_stats measure_construction(
+    ABYParty& party,
+    e_role role,
+    std::string const& variant,
+    std::size_t rows,
+    std::size_t columns,
+    uint32_t seed,
+    bool gate_stats = false
+);
+
+//as above, with own_dt the share of the poll of role, e.g. from a table_corpus;
+//is_arithmetic of the tables has to match the variant
+construction_stats measure_construction(
+    ABYParty& party,
+    e_role role,
+    std::string const& variant,
+    doodle_table_view const& own_dt,
+    bool gate_stats = false
+);
+
+//result of simulate_circuit: the evaluation of the poll, the size of the
+//circuit computing the best column and, separately, of the one retrieving
+//the no-sayers of that column
+struct circuit_simulation{
+    std::size_t best_column;
+    std::vector<bool> nos;
+    uint64_t and_gates;
+    uint64_t xor_gates;
+    uint64_t input_bits;
+    uint32_t depth;
+    uint64_t no_retrieval_and_gates;
+    uint64_t no_retrieval_xor_gates;
+};
+
+//evaluates the circuit of sel on the cleartext table dt in clear, without a
+//party, e.g. to check variants of the circuit on large tables
+circuit_simulation simulate_circuit(algorithm sel, doodle_table_view const& dt);
+
+//measurements of the executions of one evaluation of a poll
+struct execution_stats{
+    double setup_ms = 0;
+    double online_ms = 0;
+    uint64_t sent_bytes = 0;
+    uint64_t received_bytes = 0;
+    uint64_t rounds = 0;
+    //largest resident set size after an execution, before its circuit is reset
+    uint64_t phase_rss_bytes = 0;
+    bool checked = false;
+    bool correct = false;
+};
+
+//evaluates the poll of which dt is the share of this party like
+//execute_circuit and measures both executions. If clear_dt holds the poll
+//in clear, the result is checked against simulate_circuit.
+execution_stats benchmark_circuit(
+    ABYParty& party,
+    e_role role,
+    algorithm sel,
+    doodle_table_view const& dt,
+    doodle_table_view const& clear_dt = doodle_table_view()
+);
+
+//returns the minimum of the batch sizes of both parties, so that both
+//evaluate the same polls in execute_circuit_batch
+std::size_t agree_batch_size(ABYParty& party, Circuit* circ, e_role role, std::size_t batch_size);
+
+//executes a minimal circuit so that the connection and the base OTs
+//are set up before the first poll arrives
+void warm_up_party(ABYParty& party, Circuit* circ, e_role role);
+
+//estimates the offset in microseconds from the steady clock of this party to
+//that of the server, so that the traces of both servers can be merged; both
+//parties leave an execution at about the same time and then exchange when
+//they did, the median over several executions is returned
+int64_t exchange_clock_offset(ABYParty& party, Circuit* circ, e_role role);
+
 #endif
@@ -0,0 +1,205 @@
+/**
+ \file 		table_corpus.cpp
+ \author	oliver.schick92@gmail.com
+ \copyright	ABY - A Framework for Efficient Mixed-protocol Secure Two-party Computation
+ Copyright (C) 2019 Engineering Cryptographic Protocols Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+            it under the terms of the GNU Lesser General Public License as published
+            by the Free Software Foundation, either version 3 of the License, or
+            (at your option) any later version.
+            ABY is distributed in the hope that it will be useful,
+            but WITHOUT ANY WARRANTY; without even the implied warranty of
+            MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+            GNU Lesser General Public License for more details.
+            You should have received a copy of the GNU Lesser General Public License
+            along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "table_corpus.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace{
+
+constexpr char corpus_magic[8] = {'S', 'D', 'C', 'O', 'R', 'P', 'U', 'S'};
+constexpr uint32_t corpus_version = 1;
+//reads differently on a machine of the other byte order
+constexpr uint32_t corpus_byte_order = 0x01020304;
+
+static_assert(sizeof(unsigned int) == sizeof(uint32_t), "weights are stored as 32 bit values");
+
+//the entries and weights of the three tables of a poll; the size is kept a
+//multiple of the size of an entry, so the entries of every poll are aligned
+std::size_t poll_size(std::size_t const rows, std::size_t const columns){
+    std::size_t const weights = 3 * rows * sizeof(uint32_t);
+    return 3 * rows * columns * sizeof(doodle_entry)
+        + (weights + sizeof(doodle_entry) - 1) / sizeof(doodle_entry) * sizeof(doodle_entry);
+}
+
+}
+
+void write_table_corpus(std::string const& path, std::vector<corpus_poll> const& all_polls, unsigned const threads){
+    using header = table_corpus::header;
+    using index_entry = table_corpus::index_entry;
+    static_assert(sizeof(header) % sizeof(doodle_entry) == 0, "the index has to be aligned");
+    static_assert(sizeof(index_entry) % sizeof(doodle_entry) == 0, "the tables have to be aligned");
+    std::vector<corpus_poll> polls;
+    std::set<table_corpus::key> stored;
+    for(corpus_poll const& poll : all_polls){
+        if(stored.insert(table_corpus::key_of(poll)).second){
+            polls.emplace_back(poll);
+        }
+    }
+    std::vector<uint64_t> offsets;
+    offsets.reserve(polls.size());
+    std::size_t size = sizeof(header) + polls.size() * sizeof(index_entry);
+    for(corpus_poll const& poll : polls){
+        offsets.emplace_back(size);
+        size += poll_size(poll.rows, poll.columns);
+    }
+
+    int const fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        throw std::runtime_error("could not create corpus " + path + ": " + std::strerror(errno));
+    }
+    if(ftruncate(fd, size) != 0){
+        int const err = errno;
+        close(fd);
+        throw std::runtime_error("could not allocate corpus " + path + ": " + std::strerror(err));
+    }
+    void* const mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED){
+        throw std::runtime_error("could not map corpus " + path + ": " + std::strerror(errno));
+    }
+    unsigned char* const data = static_cast<unsigned char*>(mem);
+    index_entry* const index = reinterpret_cast<index_entry*>(data + sizeof(header));
+
+    //every poll is generated from its own seed, so the threads can take the
+    //polls in any order and write them straight to their place in the file
+    std::atomic<std::size_t> next{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto generate = [&]{
+        try{
+            for(std::size_t i = next++; i < polls.size(); i = next++){
+                corpus_poll const& poll = polls[i];
+                doodle_table tables[3];
+                std::tie(tables[0], tables[1], tables[2]) = generate_tables(poll.rows, poll.columns, poll.is_arithmetic, poll.seed);
+                unsigned char* out = data + offsets[i];
+                for(doodle_table const& dt : tables){
+                    out = std::copy_n(reinterpret_cast<unsigned char const*>(dt.entries.data()), dt.entries.size() * sizeof(doodle_entry), out);
+                }
+                for(doodle_table const& dt : tables){
+                    out = std::copy_n(reinterpret_cast<unsigned char const*>(dt.weights.data()), dt.weights.size() * sizeof(uint32_t), out);
+                }
+                index[i] = index_entry{poll.seed, poll.rows, poll.columns, tables[0].max_weight, poll.is_arithmetic, offsets[i]};
+            }
+        }
+        catch(...){
+            std::lock_guard<std::mutex> lock(error_mutex);
+            error = std::current_exception();
+            next = polls.size();
+        }
+    };
+    std::vector<std::thread> workers;
+    for(unsigned t = 1; t < std::max(threads, 1u); ++t){
+        workers.emplace_back(generate);
+    }
+    generate();
+    for(std::thread& w : workers){
+        w.join();
+    }
+    if(!error){
+        //the header is written last, so an incomplete corpus is not read
+        header* const h = reinterpret_cast<header*>(data);
+        std::memcpy(h->magic, corpus_magic, sizeof(corpus_magic));
+        h->version = corpus_version;
+        h->byte_order = corpus_byte_order;
+        h->num_polls = polls.size();
+    }
+    munmap(mem, size);
+    if(error){
+        std::rethrow_exception(error);
+    }
+}
+
+table_corpus::table_corpus(std::string const& path)
+: size_(0), data_(nullptr){
+    int const fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        throw std::runtime_error("could not open corpus " + path + ": " + std::strerror(errno));
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(header)){
+        close(fd);
+        throw std::runtime_error("invalid corpus " + path);
+    }
+    size_ = st.st_size;
+    void* const mem = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED){
+        throw std::runtime_error("could not map corpus " + path + ": " + std::strerror(errno));
+    }
+    data_ = static_cast<unsigned char const*>(mem);
+    auto fail = [&](std::string const& reason){
+        munmap(const_cast<unsigned char*>(data_), size_);
+        throw std::runtime_error("invalid corpus " + path + ": " + reason);
+    };
+    header const* const h = reinterpret_cast<header const*>(data_);
+    if(std::memcmp(h->magic, corpus_magic, sizeof(corpus_magic)) != 0){
+        fail("not a corpus or incompletely written");
+    }
+    if(h->version != corpus_version){
+        fail("version " + std::to_string(h->version) + " instead of " + std::to_string(corpus_version));
+    }
+    if(h->byte_order != corpus_byte_order){
+        fail("written on a machine of another byte order");
+    }
+    if(h->num_polls > (size_ - sizeof(header)) / sizeof(index_entry)){
+        fail("truncated index");
+    }
+    index_entry const* const index = reinterpret_cast<index_entry const*>(data_ + sizeof(header));
+    for(std::size_t i = 0; i < h->num_polls; ++i){
+        index_entry const& e = index[i];
+        if(e.offset % sizeof(doodle_entry) != 0 || e.offset > size_ || poll_size(e.rows, e.columns) > size_ - e.offset){
+            fail("truncated tables");
+        }
+        polls_.emplace(key(static_cast<uint32_t>(e.seed), e.rows, e.columns, e.is_arithmetic != 0), &e);
+    }
+}
+
+table_corpus::~table_corpus() noexcept{
+    munmap(const_cast<unsigned char*>(data_), size_);
+}
+
+std::tuple<doodle_table_view, doodle_table_view, doodle_table_view> table_corpus::tables(corpus_poll const& poll) const{
+    auto const it = polls_.find(key_of(poll));
+    if(it == polls_.end()){
+        throw std::runtime_error(
+            "no poll of " + std::to_string(poll.rows) + " participants and " + std::to_string(poll.columns)
+            + " time slots from seed " + std::to_string(poll.seed) + " in the corpus"
+        );
+    }
+    index_entry const& e = *it->second;
+    std::size_t const cells = e.rows * e.columns;
+    doodle_entry const* const entries = reinterpret_cast<doodle_entry const*>(data_ + e.offset);
+    unsigned int const* const weights = reinterpret_cast<unsigned int const*>(entries + 3 * cells);
+    auto table = [&](std::size_t const t){
+        return doodle_table_view(entries + t * cells, weights + t * e.rows, e.rows, e.columns, e.max_weight);
+    };
+    return std::make_tuple(table(0), table(1), table(2));
+}
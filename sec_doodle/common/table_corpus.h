@@ -0,0 +1,94 @@
+/**
+ \file 		table_corpus.h
+ \author	oliver.schick92@gmail.com
+ \copyright	ABY - A Framework for Efficient Mixed-protocol Secure Two-party Computation
+ Copyright (C) 2019 Engineering Cryptographic Protocols Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+            it under the terms of the GNU Lesser General Public License as published
+            by the Free Software Foundation, either version 3 of the License, or
+            (at your option) any later version.
+            ABY is distributed in the hope that it will be useful,
+            but WITHOUT ANY WARRANTY; without even the implied warranty of
+            MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+            GNU Lesser General Public License for more details.
+            You should have received a copy of the GNU Lesser General Public License
+            along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ABY_SEC_DOODLE_TABLE_CORPUS_H_19102026_2330
+#define ABY_SEC_DOODLE_TABLE_CORPUS_H_19102026_2330
+
+#include "sec_doodle.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+//a poll of a corpus, its tables are generate_tables(rows, columns, is_arithmetic, seed)
+struct corpus_poll{
+    uint32_t seed;
+    std::size_t rows, columns;
+    bool is_arithmetic;
+};
+
+//generates the tables of polls on threads and writes them to a corpus file at
+//path, replacing an existing one; a poll listed twice is stored once
+void write_table_corpus(std::string const& path, std::vector<corpus_poll> const& polls, unsigned threads);
+
+//Read only memory mapped file of generated polls, so that benchmarks run on
+//the same tables on every machine and loading a table costs nothing. The
+//tables are stored in the row format of doodle_table and in the byte order
+//of the machine that wrote them, which is checked when the file is opened.
+//
+//layout: header | index entry of each poll | per poll: entries of the plain,
+//alice and bob table, weights of the plain, alice and bob table
+class table_corpus{
+public:
+    explicit table_corpus(std::string const& path);
+
+    table_corpus(table_corpus const&) = delete;
+    table_corpus& operator=(table_corpus const&) = delete;
+
+    ~table_corpus() noexcept;
+
+    std::size_t size() const noexcept{
+        return polls_.size();
+    }
+
+    //the plain, alice and bob table of poll, which has to be in the corpus
+    std::tuple<doodle_table_view, doodle_table_view, doodle_table_view> tables(corpus_poll const& poll) const;
+
+private:
+    struct header{
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t num_polls;
+    };
+
+    struct index_entry{
+        uint64_t seed;
+        uint64_t rows;
+        uint64_t columns;
+        uint64_t max_weight;
+        uint64_t is_arithmetic;
+        //of the entries of the plain table from the start of the file
+        uint64_t offset;
+    };
+
+    friend void write_table_corpus(std::string const&, std::vector<corpus_poll> const&, unsigned);
+
+    using key = std::tuple<uint32_t, std::size_t, std::size_t, bool>;
+
+    static key key_of(corpus_poll const& poll){
+        return key(poll.seed, poll.rows, poll.columns, poll.is_arithmetic);
+    }
+
+    std::size_t size_;
+    unsigned char const* data_;
+    std::map<key, index_entry const*> polls_;
+};
+
+#endif
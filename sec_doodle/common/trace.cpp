@@ -0,0 +1,96 @@
+/**
+ \file 		trace.cpp
+ \author	oliver.schick92@gmail.com
+ \copyright	ABY - A Framework for Efficient Mixed-protocol Secure Two-party Computation
+ Copyright (C) 2019 Engineering Cryptographic Protocols Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+            it under the terms of the GNU Lesser General Public License as published
+            by the Free Software Foundation, either version 3 of the License, or
+            (at your option) any later version.
+            ABY is distributed in the hope that it will be useful,
+            but WITHOUT ANY WARRANTY; without even the implied warranty of
+            MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+            GNU Lesser General Public License for more details.
+            You should have received a copy of the GNU Lesser General Public License
+            along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "trace.h"
+
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <stdexcept>
+
+namespace{
+
+struct {
+    std::atomic<bool> enabled{false};
+    std::atomic<int64_t> offset_us{0};
+    int pid = 0;
+    std::mutex m;
+    std::ofstream out;
+} trace_file;
+
+//small ids of the threads, in the order they first trace a span
+int thread_id(){
+    static std::atomic<int> next{1};
+    thread_local int const id = next++;
+    return id;
+}
+
+double timestamp_us(trace_clock::time_point const t){
+    return std::chrono::duration<double, std::micro>(t.time_since_epoch()).count() + trace_file.offset_us;
+}
+
+}
+
+void start_tracing(std::string const& path, int const pid, std::string const& process_name){
+    std::lock_guard<std::mutex> lock(trace_file.m);
+    trace_file.out.open(path);
+    if(!trace_file.out){
+        throw std::runtime_error("cannot open trace file " + path);
+    }
+    trace_file.pid = pid;
+    trace_file.out << std::fixed << std::setprecision(3) << "[\n"
+                   << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << pid
+                   << ", \"args\": {\"name\": \"" << process_name << "\"}},\n";
+    trace_file.enabled = true;
+}
+
+bool tracing(){
+    return trace_file.enabled;
+}
+
+void set_trace_clock_offset(int64_t const offset_us){
+    trace_file.offset_us = offset_us;
+}
+
+int64_t trace_clock_us(){
+    return std::chrono::duration_cast<std::chrono::microseconds>(trace_clock::now().time_since_epoch()).count();
+}
+
+void trace_complete(
+    char const* const name,
+    trace_clock::time_point const start,
+    trace_clock::time_point const end,
+    std::string const& args
+){
+    if(!tracing()){
+        return;
+    }
+    int const tid = thread_id();
+    std::lock_guard<std::mutex> lock(trace_file.m);
+    trace_file.out << "{\"name\": \"" << name << "\", \"ph\": \"X\", \"pid\": " << trace_file.pid
+                   << ", \"tid\": " << tid << ", \"ts\": " << timestamp_us(start)
+                   << ", \"dur\": " << std::chrono::duration<double, std::micro>(end - start).count()
+                   << ", \"args\": {" << args << "}},\n";
+}
+
+void flush_trace(){
+    if(tracing()){
+        std::lock_guard<std::mutex> lock(trace_file.m);
+        trace_file.out.flush();
+    }
+}
@@ -0,0 +1,76 @@
+/**
+ \file 		trace.h
+ \author	oliver.schick92@gmail.com
+ \copyright	ABY - A Framework for Efficient Mixed-protocol Secure Two-party Computation
+ Copyright (C) 2019 Engineering Cryptographic Protocols Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+            it under the terms of the GNU Lesser General Public License as published
+            by the Free Software Foundation, either version 3 of the License, or
+            (at your option) any later version.
+            ABY is distributed in the hope that it will be useful,
+            but WITHOUT ANY WARRANTY; without even the implied warranty of
+            MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+            GNU Lesser General Public License for more details.
+            You should have received a copy of the GNU Lesser General Public License
+            along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ABY_SEC_DOODLE_TRACE_H_19102026_2140
+#define ABY_SEC_DOODLE_TRACE_H_19102026_2140
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+//Timeline of the evaluation of polls in the Chrome trace-event format, to be
+//viewed in chrome://tracing or ui.perfetto.dev. Tracing is off until
+//start_tracing is called, spans can then be traced from any thread.
+using trace_clock = std::chrono::steady_clock;
+
+//writes the trace of process pid, named process_name, to path; the file is a
+//JSON array without the closing bracket, which the viewers accept
+void start_tracing(std::string const& path, int pid, std::string const& process_name);
+
+bool tracing();
+
+//offset_us is added to all following timestamps, so that the traces of both
+//servers are on the clock of one of them and can be merged
+void set_trace_clock_offset(int64_t offset_us);
+
+//microseconds on the steady clock, as exchanged between the servers
+int64_t trace_clock_us();
+
+//traces a span of the calling thread; args are the members of a JSON object,
+//e.g. "\"poll\": 3"
+void trace_complete(
+    char const* name,
+    trace_clock::time_point start,
+    trace_clock::time_point end,
+    std::string const& args = ""
+);
+
+//writes the buffered spans to the file
+void flush_trace();
+
+//traces the lifetime of the object
+class trace_span{
+public:
+    explicit trace_span(char const* name, std::string args = "")
+    : name_(name), args_(std::move(args)), start_(trace_clock::now()) {}
+
+    trace_span(trace_span const&) = delete;
+    trace_span& operator=(trace_span const&) = delete;
+
+    ~trace_span(){
+        if(tracing()){
+            trace_complete(name_, start_, trace_clock::now(), args_);
+        }
+    }
+
+private:
+    char const* name_;
+    std::string args_;
+    trace_clock::time_point start_;
+};
+
+#endif
@@ -23,9 +23,14 @@
 #include <abycore/sharing/sharing.h>
 
 #include "common/sec_doodle.h"
+#include "common/poll_queue.h"
+#include "common/ballot_log.h"
+#include "common/metrics.h"
+#include "common/trace.h"
 
 #include <cstdio>
 #include <cstring>
+#include <cerrno>
 #include <cassert>
 #include <iostream>
 #include <vector>
@@ -34,7 +39,20 @@
 #include <numeric>
 #include <memory>
 #include <cstdlib>
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <set>
+#include <functional>
+#include <exception>
+#include <stdexcept>
 
+#include <sys/resource.h>
+#include <dirent.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
@@ -71,7 +89,9 @@ void parse_selections(
     };
     for(std::size_t i = 0; *selections != '\0' && i < message_length; ++i, ++selections){
         unsigned char b = parse_base64(*selections);
-        assert(b != 255);
+        if(b == 255){
+            throw std::runtime_error("invalid character in ballot");
+        }
         result.emplace_back((b >> 4) & 0x3);
         ++i;
         if(i < message_length){
@@ -101,6 +121,8 @@ std::string openssl_error(){
 
 struct rsa_data_t{
     RSA* rsa;
+    //observes the time of every decryption, if set
+    histogram* decrypt_seconds = nullptr;
     rsa_data_t(char const* const key_file)
     : rsa(nullptr){
         BIO* const pri = BIO_new_file(key_file, "r");
@@ -117,19 +139,62 @@ struct rsa_data_t{
     ~rsa_data_t(){
         RSA_free(rsa);
     }
+    //may be called concurrently from several threads
     void decrypt_message(
         std::vector<doodle_entry>& result, 
         unsigned char const* const encrypted_message, 
         std::size_t const message_length
-    ){
-        RSA_private_decrypt(RSA_size(rsa), encrypted_message, msg, rsa, RSA_PKCS1_PADDING);
+    ) const{
+        unsigned char msg[buffer_size];
+        auto const start = std::chrono::steady_clock::now();
+        int const length = RSA_private_decrypt(RSA_size(rsa), encrypted_message, msg, rsa, RSA_PKCS1_PADDING);
+        observe_decryption_(start);
+        //the padding leaves room for the terminating zero parse_selections
+        //stops at
+        if(length < 0){
+            throw std::runtime_error(std::string("could not decrypt ballot:\n") + openssl_error());
+        }
+        msg[length] = '\0';
         parse_selections(result, msg, message_length);
-        
+        if(result.size() != message_length){
+            throw std::runtime_error("invalid ballot");
+        }
+    }
+    
+    //decrypts a ballot of additive shares, each an 8 byte big-endian
+    //doodle_entry, one per time slot
+    void decrypt_additive(
+        std::vector<doodle_entry>& result, 
+        unsigned char const* const encrypted_message, 
+        std::size_t const time_slots
+    ) const{
+        unsigned char msg[buffer_size];
+        auto const start = std::chrono::steady_clock::now();
+        int const length = RSA_private_decrypt(RSA_size(rsa), encrypted_message, msg, rsa, RSA_PKCS1_PADDING);
+        observe_decryption_(start);
+        if(length < 0 || static_cast<std::size_t>(length) != 8 * time_slots){
+            throw std::runtime_error("invalid additively shared ballot");
+        }
+        result.resize(time_slots);
+        for(std::size_t i = 0; i < time_slots; ++i){
+            doodle_entry e = 0;
+            for(std::size_t j = 0; j < 8; ++j){
+                e = e << 8 | msg[8*i + j];
+            }
+            result[i] = e;
+        }
     }
     
     static constexpr std::size_t buffer_size = RSA_keylength/8;
-    unsigned char msg[buffer_size];
     
+private:
+    void observe_decryption_(std::chrono::steady_clock::time_point const start) const{
+        auto const end = std::chrono::steady_clock::now();
+        if(decrypt_seconds != nullptr){
+            decrypt_seconds->observe(std::chrono::duration<double>(end - start).count());
+        }
+        trace_complete("decrypt", start, end);
+    }
 };
 
 struct server{
@@ -298,6 +363,19 @@ struct ssl_server{
             return SSL_write(ssl_, buffer, buffer_size);
         }
         
+        //reads exactly buffer_size bytes unless the connection ends before
+        bool read_all(void* const buffer, std::size_t const buffer_size) const noexcept{
+            std::size_t received = 0;
+            while(received < buffer_size){
+                int const n = SSL_read(ssl_, static_cast<unsigned char*>(buffer) + received, buffer_size - received);
+                if(n <= 0){
+                    return false;
+                }
+                received += n;
+            }
+            return true;
+        }
+        
     private: 
         server::session session_;
         SSL* ssl_;
@@ -329,9 +407,514 @@ private:
     server s_;
 };
 
+//reads the encrypted ballots of one poll from sess. The ballots are decrypted
+//by num_threads worker threads while the following ballots are still being
+//received, so that decryption overlaps with the transfer of the poll.
+doodle_table read_poll(
+    ssl_server::session const& sess,
+    rsa_data_t const& rsa_data,
+    unsigned int const num_threads
+){
+    using block = std::array<unsigned char, rsa_data_t::buffer_size>;
+    unsigned char header[4];
+    sess.read(header, 4);
+    const unsigned int time_slots = header[0] << 24 | header[1] << 16 | header[2] << 8 | header[3];
+    
+    //deques do not invalidate references to their elements on push_back,
+    //so workers can decrypt outside of the lock
+    std::deque<block> blocks;
+    std::deque<std::vector<doodle_entry>> rows;
+    std::size_t num_received = 0, num_taken = 0;
+    bool done = false;
+    std::mutex m;
+    std::condition_variable cv;
+    
+    auto worker = [&]{
+        std::unique_lock<std::mutex> lock(m);
+        while(true){
+            cv.wait(lock, [&]{ return num_taken < num_received || done; });
+            if(num_taken == num_received){
+                return;
+            }
+            block const& b = blocks[num_taken];
+            std::vector<doodle_entry>& row = rows[num_taken];
+            ++num_taken;
+            lock.unlock();
+            rsa_data.decrypt_message(row, b.data(), time_slots);
+            lock.lock();
+        }
+    };
+    //an exception of a worker is rethrown once the poll is read, as on the
+    //worker thread it would terminate the server
+    std::vector<std::exception_ptr> errors(num_threads);
+    std::vector<std::thread> workers;
+    workers.reserve(num_threads);
+    for(unsigned int i = 0; i < num_threads; ++i){
+        workers.emplace_back([&, i]{
+            try{
+                worker();
+            }
+            catch(...){
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+    
+    block input;
+    while(sess.read(input.data(), input.size()) == input.size()){
+        {
+            std::lock_guard<std::mutex> lock(m);
+            blocks.push_back(input);
+            rows.emplace_back();
+            ++num_received;
+        }
+        cv.notify_one();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m);
+        done = true;
+    }
+    cv.notify_all();
+    for(auto& t : workers){
+        t.join();
+    }
+    for(std::exception_ptr const& error : errors){
+        if(error){
+            std::rethrow_exception(error);
+        }
+    }
+    
+    std::vector<doodle_entry> selections;
+    selections.reserve(rows.size() * time_slots);
+    for(auto const& row : rows){
+        selections.insert(selections.end(), row.begin(), row.end());
+    }
+    return doodle_table(std::move(selections), rows.size(), time_slots);
+}
+
+//sends the winning time slot and the bit vector of participants saying no
+void send_results(ssl_server::session& sess, std::size_t const winner, std::vector<bool> const& nos){
+    std::vector<unsigned char> buf(4 + (nos.size() + 7)/8, 0);
+    buf[0] = static_cast<unsigned char>(winner >> 24);
+    buf[1] = static_cast<unsigned char>(winner >> 16);
+    buf[2] = static_cast<unsigned char>(winner >> 8);
+    buf[3] = static_cast<unsigned char>(winner);
+    for(std::size_t i = 0; i < nos.size(); ++i){
+        buf[4 + i/8] |= nos[i] << (7 - i%8);
+    }
+    std::cout << "data sent: " << sess.write(buf.data(), buf.size()) << std::endl;
+}
+
+enum struct ballot_encoding : unsigned char{
+    xor_shared = 0,
+    additive = 1
+};
+
+struct pending_poll{
+    ssl_server::session sess;
+    doodle_table dt;
+    //0 for polls received as a whole on the legacy endpoint
+    uint32_t id = 0;
+    //arrival number of polls on the legacy endpoint, which both servers
+    //receive in the same order
+    uint32_t seq = 0;
+    std::chrono::steady_clock::time_point arrival = std::chrono::steady_clock::now();
+    ballot_encoding encoding = ballot_encoding::xor_shared;
+    //number of best time slots sent back, only ingested polls ask for more than one
+    std::size_t top_k = 1;
+    additive_column_sums sums;
+    //ballots of ingested polls, dt is empty then; the log is owned by the
+    //registry and not changed until done is called
+    ballot_log const* log = nullptr;
+    //XOR shared column sums of the last evaluation of an ingested poll and
+    //the rows changed since, see execute_circuit_incremental
+    std::vector<shared_value> carried_sums;
+    doodle_table removed, added;
+    //called with the updated column sums after an ingested poll is evaluated
+    std::function<void(std::vector<shared_value>)> done;
+    //called instead of done if the evaluation of an ingested poll failed
+    std::function<void()> failed;
+    
+    doodle_table_view table() const{
+        return log ? log->table() : doodle_table_view(dt);
+    }
+    
+    //identifies the poll in the queues of both servers
+    uint64_t ticket() const{
+        return id != 0 ? id : uint64_t(1) << 32 | seq;
+    }
+    
+    uint64_t cost(algorithm alg) const{
+        doodle_table_view const t = table();
+        std::size_t summed_rows = t.num_rows;
+        if(encoding == ballot_encoding::additive){
+            summed_rows = 0;
+        }
+        else if(log && !carried_sums.empty()){
+            summed_rows = removed.num_rows + added.num_rows;
+        }
+        return estimate_circuit_cost(alg, summed_rows, t.num_rows, t.num_columns, t.max_weight);
+    }
+};
+
+//poll collecting ballots on the ingestion endpoint. A closed poll stays open
+//for changed ballots and can be closed again, which only re-evaluates the
+//changes; participants who have not voted have a row of yes, see ballot_log.
+struct ingested_poll{
+    ballot_encoding encoding;
+    std::unique_ptr<ballot_log> log;
+    additive_column_sums sums;
+    std::vector<shared_value> carried_sums;
+    //ballots at the last evaluation of the participants who voted again since,
+    //by participant; the rows of the servers can only be matched by participant
+    std::map<uint32_t, std::vector<doodle_entry>> removed;
+    //participants who voted since the last evaluation
+    std::set<uint32_t> changed;
+    //the log is being evaluated, ballots are deferred until it is done
+    bool evaluating = false;
+    std::vector<std::pair<uint32_t, std::vector<doodle_entry>>> deferred;
+    
+    void apply_ballot(uint32_t const participant, std::vector<doodle_entry> const& row){
+        if(evaluating){
+            deferred.emplace_back(participant, row);
+            return;
+        }
+        doodle_entry const* const previous = log->find(participant);
+        std::size_t const time_slots = log->num_columns();
+        if(encoding == ballot_encoding::additive){
+            if(previous != nullptr){
+                sums.subtract(boost::make_iterator_range(previous, previous + time_slots));
+            }
+            sums.add(row);
+        }
+        else if(!carried_sums.empty()){
+            //the row of a participant who had not voted was summed as zero, so
+            //only a previous ballot has to be removed from the sums
+            if(changed.insert(participant).second && previous != nullptr){
+                removed.emplace(participant, std::vector<doodle_entry>(previous, previous + time_slots));
+            }
+        }
+        log->write(participant, row.data());
+    }
+    
+    //ends an evaluation, successful or not, and applies the ballots deferred
+    //during it
+    void finish_evaluation(){
+        evaluating = false;
+        auto ballots = std::move(deferred);
+        deferred.clear();
+        for(auto const& ballot : ballots){
+            apply_ballot(ballot.first, ballot.second);
+        }
+    }
+};
+
+struct poll_registry{
+    std::mutex m;
+    std::map<uint32_t, ingested_poll> polls;
+    //directory of the ballot logs, empty to keep them in memory
+    std::string log_directory;
+    //largest polls that can be opened, as they size the ballot logs
+    std::size_t max_participants = 0, max_time_slots = 0;
+    
+    std::string log_path(uint32_t const id) const{
+        return log_directory.empty() ? std::string() : log_directory + "/poll" + std::to_string(id) + ".log";
+    }
+    
+    //reopens the ballot logs left in log_directory by a previous run. The
+    //column sums of the last evaluations are not kept, so the first closing
+    //frame of a recovered poll evaluates all of its rows. Logs that cannot be
+    //reopened are reported and left in place.
+    void recover(){
+        if(log_directory.empty()){
+            return;
+        }
+        DIR* const dir = opendir(log_directory.c_str());
+        if(dir == nullptr){
+            throw std::runtime_error("could not open log directory " + log_directory + ": " + std::strerror(errno));
+        }
+        while(dirent const* const entry = readdir(dir)){
+            unsigned long id;
+            int length = 0;
+            if(std::sscanf(entry->d_name, "poll%lu.log%n", &id, &length) != 1
+                || entry->d_name[length] != '\0' || id == 0 || uint32_t(id) != id
+                || log_path(id) != log_directory + "/" + entry->d_name){
+                continue;
+            }
+            try{
+                auto log = std::make_unique<ballot_log>(log_path(id));
+                if(log->encoding() > static_cast<unsigned char>(ballot_encoding::additive)){
+                    throw std::runtime_error("invalid encoding");
+                }
+                std::size_t const time_slots = log->num_columns();
+                ingested_poll p{static_cast<ballot_encoding>(log->encoding()), std::move(log), additive_column_sums(time_slots)};
+                if(p.encoding == ballot_encoding::additive){
+                    for(std::size_t i = 0; i < p.log->num_participants(); ++i){
+                        if(doodle_entry const* const row = p.log->find(i)){
+                            p.sums.add(boost::make_iterator_range(row, row + time_slots));
+                        }
+                    }
+                }
+                std::cout << "recovered poll " << id << " with " << p.log->num_ballots() << " ballots" << std::endl;
+                polls.emplace(id, std::move(p));
+            }
+            catch(std::exception const& e){
+                std::cerr << "could not recover ballot log " << entry->d_name << ": " << e.what() << std::endl;
+            }
+        }
+        closedir(dir);
+    }
+};
+
+uint32_t read_uint32(unsigned char const* const buf){
+    return uint32_t(buf[0]) << 24 | uint32_t(buf[1]) << 16 | uint32_t(buf[2]) << 8 | uint32_t(buf[3]);
+}
+
+//handles the frames of one connection to the ingestion endpoint. Every frame
+//starts with a type byte and the 4 byte big-endian id of the poll:
+//'O' opens the poll, followed by the number of time slots (4 bytes), the number
+//    of participants (4 bytes) and the ballot_encoding (1 byte),
+//'B' casts or replaces the ballot of a participant, followed by the index of
+//    the participant (4 bytes) and the RSA encrypted ballot,
+//'C' queues the poll in its current state for evaluation, which needs at
+//    least one ballot; the results are sent back on this connection, which
+//    is not read any further,
+//'K' like 'C', followed by the number of best time slots (1 byte) to send
+//    back, best first, each with its no-sayers,
+//'R' removes the poll and its ballot log.
+//Both servers have to receive the same ballots before a closing frame.
+void ingest_ballots(
+    ssl_server::session sess,
+    rsa_data_t const& rsa_data,
+    poll_registry& registry,
+    poll_queue<pending_poll>& polls
+){
+    using ballot_frame = std::array<unsigned char, 4 + rsa_data_t::buffer_size>;
+    auto find_poll = [&](uint32_t const id){
+        auto const it = registry.polls.find(id);
+        if(it == registry.polls.end()){
+            throw std::runtime_error("unknown poll " + std::to_string(id));
+        }
+        return it;
+    };
+    
+    unsigned char header[5];
+    while(sess.read_all(header, sizeof(header))){
+        uint32_t const id = read_uint32(header + 1);
+        if(id == 0){
+            throw std::runtime_error("invalid poll id 0");
+        }
+        switch(header[0]){
+        case 'O':{
+            unsigned char open[9];
+            if(!sess.read_all(open, sizeof(open))){
+                throw std::runtime_error("incomplete frame");
+            }
+            uint32_t const time_slots = read_uint32(open), participants = read_uint32(open + 4);
+            if(time_slots == 0 || participants == 0 || open[8] > static_cast<unsigned char>(ballot_encoding::additive)){
+                throw std::runtime_error("invalid poll parameters");
+            }
+            if(participants > registry.max_participants || time_slots > registry.max_time_slots){
+                throw std::runtime_error(
+                    "poll of " + std::to_string(participants) + " participants and "
+                    + std::to_string(time_slots) + " time slots exceeds the limits"
+                );
+            }
+            std::lock_guard<std::mutex> lock(registry.m);
+            if(registry.polls.count(id) != 0){
+                throw std::runtime_error("poll " + std::to_string(id) + " is already open");
+            }
+            registry.polls.emplace(id, ingested_poll{
+                static_cast<ballot_encoding>(open[8]),
+                std::make_unique<ballot_log>(registry.log_path(id), participants, time_slots, open[8]),
+                additive_column_sums(time_slots)
+            });
+            break;
+        }
+        case 'B':{
+            ballot_frame ballot;
+            if(!sess.read_all(ballot.data(), ballot.size())){
+                throw std::runtime_error("incomplete frame");
+            }
+            uint32_t const participant = read_uint32(ballot.data());
+            ballot_encoding encoding;
+            std::size_t time_slots;
+            {
+                std::lock_guard<std::mutex> lock(registry.m);
+                ingested_poll const& p = find_poll(id)->second;
+                if(participant >= p.log->num_participants()){
+                    throw std::runtime_error("invalid participant " + std::to_string(participant));
+                }
+                encoding = p.encoding;
+                time_slots = p.log->num_columns();
+            }
+            //decryption is done outside of the lock, so several connections
+            //can decrypt ballots concurrently
+            std::vector<doodle_entry> row;
+            if(encoding == ballot_encoding::additive){
+                rsa_data.decrypt_additive(row, ballot.data() + 4, time_slots);
+            }
+            else{
+                rsa_data.decrypt_message(row, ballot.data() + 4, time_slots);
+            }
+            if(row.size() != time_slots){
+                throw std::runtime_error("invalid ballot");
+            }
+            std::lock_guard<std::mutex> lock(registry.m);
+            find_poll(id)->second.apply_ballot(participant, row);
+            break;
+        }
+        case 'C':
+        case 'K':{
+            std::size_t top_k = 1;
+            if(header[0] == 'K'){
+                unsigned char k;
+                if(!sess.read_all(&k, 1)){
+                    throw std::runtime_error("incomplete frame");
+                }
+                top_k = std::max<std::size_t>(k, 1);
+            }
+            pending_poll pending{std::move(sess), doodle_table(), id};
+            pending.top_k = top_k;
+            {
+                std::lock_guard<std::mutex> lock(registry.m);
+                ingested_poll& p = find_poll(id)->second;
+                if(p.evaluating){
+                    throw std::runtime_error("poll " + std::to_string(id) + " is already being evaluated");
+                }
+                if(p.log->num_ballots() == 0){
+                    throw std::runtime_error("poll " + std::to_string(id) + " has no ballots");
+                }
+                p.evaluating = true;
+                pending.encoding = p.encoding;
+                pending.sums = p.sums;
+                pending.log = p.log.get();
+                pending.carried_sums = p.carried_sums;
+                std::size_t const time_slots = p.log->num_columns();
+                pending.removed = doodle_table(std::vector<doodle_entry>(), 0, time_slots);
+                for(auto const& r : p.removed){
+                    pending.removed.add_row();
+                    std::copy(r.second.begin(), r.second.end(), pending.removed.entries.end() - time_slots);
+                }
+                pending.added = doodle_table(std::vector<doodle_entry>(), 0, time_slots);
+                for(uint32_t const participant : p.changed){
+                    doodle_entry const* const row = p.log->find(participant);
+                    pending.added.add_row();
+                    std::copy(row, row + time_slots, pending.added.entries.end() - time_slots);
+                }
+            }
+            pending.done = [&registry, id](std::vector<shared_value> sums){
+                std::lock_guard<std::mutex> lock(registry.m);
+                ingested_poll& p = registry.polls.at(id);
+                p.carried_sums = std::move(sums);
+                p.removed.clear();
+                p.changed.clear();
+                p.finish_evaluation();
+            };
+            //the changes stay pending for the next closing frame
+            pending.failed = [&registry, id]{
+                std::lock_guard<std::mutex> lock(registry.m);
+                registry.polls.at(id).finish_evaluation();
+            };
+            polls.push(std::move(pending));
+            return;
+        }
+        case 'R':{
+            std::lock_guard<std::mutex> lock(registry.m);
+            auto const it = find_poll(id);
+            if(it->second.evaluating){
+                throw std::runtime_error("poll " + std::to_string(id) + " is being evaluated");
+            }
+            registry.polls.erase(it);
+            std::string const path = registry.log_path(id);
+            if(!path.empty() && unlink(path.c_str()) != 0){
+                std::cerr << "could not remove ballot log " << path << ": " << std::strerror(errno) << std::endl;
+            }
+            break;
+        }
+        default:
+            throw std::runtime_error("unknown frame type");
+        }
+    }
+}
+
+//metrics of closing polls, served in the Prometheus text format with -M;
+//the circuit metrics are per execution, which may evaluate several polls
+struct server_metrics{
+    metrics_registry registry;
+    histogram& ballot_read = registry.add_histogram(
+        "sec_doodle_ballot_read_seconds", "Time to receive and decrypt the ballots of a poll on the legacy endpoint", latency_buckets()
+    );
+    histogram& rsa_decrypt = registry.add_histogram(
+        "sec_doodle_rsa_decrypt_seconds", "Time to decrypt one ballot", latency_buckets()
+    );
+    histogram& result_send = registry.add_histogram(
+        "sec_doodle_result_send_seconds", "Time to send the results of a poll", latency_buckets()
+    );
+    histogram& poll_close = registry.add_histogram(
+        "sec_doodle_poll_close_seconds", "Time from the arrival of a poll to its results being sent", latency_buckets()
+    );
+    counter& polls = registry.add_counter("sec_doodle_polls_total", "Evaluated polls");
+    histogram& resident_after_reset = registry.add_histogram(
+        "sec_doodle_resident_bytes_after_reset", "Resident memory after the circuits of a batch of polls are reset", memory_buckets()
+    );
+    counter& memory_growth = registry.add_counter(
+        "sec_doodle_memory_growth_warnings_total", "Batches after which the memory in use had grown after each of the preceding ones"
+    );
+
+    struct phase_metrics{
+        histogram& build;
+        histogram& setup;
+        histogram& online;
+        histogram& resident;
+        counter& and_gates;
+        counter& sent_bytes;
+        counter& received_bytes;
+    };
+    phase_metrics column_sums = phase_metrics_("column_sums");
+    phase_metrics no_retrieval = phase_metrics_("no_retrieval");
+
+    void observe(phase_execution_stats const& stats){
+        phase_metrics& m = stats.phase == circuit_phase::column_sums ? column_sums : no_retrieval;
+        m.build.observe(stats.build_ms / 1000);
+        m.setup.observe(stats.setup_ms / 1000);
+        m.online.observe(stats.online_ms / 1000);
+        m.resident.observe(stats.memory.rss_bytes);
+        m.and_gates.add(stats.and_gates);
+        m.sent_bytes.add(stats.sent_bytes);
+        m.received_bytes.add(stats.received_bytes);
+    }
+
+private:
+    phase_metrics phase_metrics_(std::string const& phase){
+        std::string const label = "phase=\"" + phase + "\"";
+        return phase_metrics{
+            registry.add_histogram("sec_doodle_circuit_build_seconds", "Time to build the circuit of an execution", latency_buckets(), label),
+            registry.add_histogram("sec_doodle_setup_seconds", "Setup phase of an execution", latency_buckets(), label),
+            registry.add_histogram("sec_doodle_online_seconds", "Online phase of an execution", latency_buckets(), label),
+            registry.add_histogram(
+                "sec_doodle_phase_resident_bytes", "Resident memory after an execution, before its circuit is reset", memory_buckets(), label
+            ),
+            registry.add_counter("sec_doodle_and_gates_total", "AND gates of the executed circuits", label),
+            registry.add_counter("sec_doodle_sent_bytes_total", "Bytes sent to the other server", label),
+            registry.add_counter("sec_doodle_received_bytes_total", "Bytes received from the other server", label)
+        };
+    }
+};
+
+//the ticket of a poll, which is the same on both servers, as arguments of its
+//trace spans
+std::string poll_trace_args(uint64_t const ticket){
+    return "\"poll\": " + std::to_string(ticket);
+}
+
 int32_t read_test_options(int32_t* argcp, char*** argvp, e_role* role,
 		uint32_t* bitlen, uint32_t* nvals, uint32_t* secparam, std::string* address,
-		uint16_t* port, int32_t* test_op) {
+		uint16_t* port, int32_t* test_op, uint32_t* batch_window, uint32_t* max_batch,
+		uint32_t* shards, uint32_t* shard_threshold, uint32_t* chunk_rows,
+		uint32_t* ingest_port, std::string* log_directory, uint32_t* aging,
+		uint32_t* metrics_port, std::string* trace_file, uint32_t* max_participants,
+		uint32_t* max_time_slots) {
 
 	uint32_t int_role = 0, int_port = 0;
 	bool useffc = false;
@@ -348,6 +931,30 @@ int32_t read_test_options(int32_t* argcp, char*** argvp, e_role* role,
 					(void*) &int_port, T_NUM, "p", "Port, default: 7766", false,
 					false }, { (void*) test_op, T_NUM, "t",
 					"Single test (leave out for all operations), default: off",
+					false, false }, { (void*) batch_window, T_NUM, "w",
+					"Batching window in ms for small polls, default: 0 (no batching)",
+					false, false }, { (void*) max_batch, T_NUM, "m",
+					"Maximum number of polls per batch, default: 16", false,
+					false }, { (void*) shards, T_NUM, "S",
+					"Number of additional party pairs for sharding large polls (on the ports following -p), default: 0",
+					false, false }, { (void*) shard_threshold, T_NUM, "L",
+					"Minimum number of participants * time slots of a sharded poll, default: 100000",
+					false, false }, { (void*) chunk_rows, T_NUM, "C",
+					"Evaluate polls with more participants in chunks of this many participants, default: 0 (off)",
+					false, false }, { (void*) ingest_port, T_NUM, "i",
+					"Port of the endpoint receiving ballots one by one, default: 0 (off)",
+					false, false }, { (void*) log_directory, T_STR, "l",
+					"Directory of the ballot logs of the ingestion endpoint, default: none (kept in memory)",
+					false, false }, { (void*) aging, T_NUM, "q",
+					"Schedule the poll with the smallest estimated cost first, reduced by this much per ms of waiting, default: 0 (first come, first served)",
+					false, false }, { (void*) metrics_port, T_NUM, "M",
+					"Local port serving Prometheus metrics, default: 0 (off)",
+					false, false }, { (void*) trace_file, T_STR, "T",
+					"File the Chrome trace of the evaluation of polls is written to, default: none (off)",
+					false, false }, { (void*) max_participants, T_NUM, "P",
+					"Maximum number of participants of a poll opened on the ingestion endpoint, default: 10000",
+					false, false }, { (void*) max_time_slots, T_NUM, "D",
+					"Maximum number of time slots of a poll opened on the ingestion endpoint, default: 1000",
 					false, false } };
 
 	if (!parse_options(argcp, argvp, options,
@@ -376,9 +983,13 @@ int main(int argc, char** argv) {
 	std::string address = "127.0.0.1";
 	int32_t test_op = -1;
 	e_mt_gen_alg mt_alg = MT_OT;
+	uint32_t batch_window = 0, max_batch = 16, shards = 0, shard_threshold = 100000, chunk_rows = 0, ingest_port = 0, aging = 0, metrics_port = 0;
+	uint32_t max_participants = 10000, max_time_slots = 1000;
+	std::string log_directory, trace_file;
 
 	read_test_options(&argc, &argv, &role, &bitlen, &nvals, &secparam, &address,
-			&port, &test_op);
+			&port, &test_op, &batch_window, &max_batch, &shards, &shard_threshold, &chunk_rows, &ingest_port, &log_directory, &aging, &metrics_port, &trace_file,
+			&max_participants, &max_time_slots);
             
     seclvl sec_lvl = get_sec_lvl(secparam);
     #ifdef TESTING
@@ -387,88 +998,290 @@ int main(int argc, char** argv) {
     char const* const private_key_filename = (role == SERVER ? "../../src/examples/sec_doodle/private-key-1.pem" : "../../src/examples/sec_doodle/private-key-2.pem");
     char const* const certificate_filename = (role == SERVER ? "../../src/examples/sec_doodle/certificate-1.cer" : "../../src/examples/sec_doodle/certificate-2.cer");
     
+    server_metrics metrics;
+    set_execution_observer([&metrics](phase_execution_stats const& stats){ metrics.observe(stats); });
     rsa_data_t rsa_data(private_key_filename);
+    rsa_data.decrypt_seconds = &metrics.rsa_decrypt;
+    unsigned int const decrypt_threads = std::max(1u, std::thread::hardware_concurrency());
     ssl_server s(role == SERVER ? 7779 : 7775, private_key_filename, certificate_filename);
     
     e_sharing sh = S_YAO;
     ABYParty party(role, const_cast<char*>(address.c_str()), port, sec_lvl, bitlen, nthreads, mt_alg);
     std::vector<Sharing*>& sharings = party.GetSharings();
     BooleanCircuit* circ = static_cast<BooleanCircuit*>(sharings[sh]->GetCircuitBuildRoutine());
+    //the party lives for the whole lifetime of the server, so the base OTs
+    //are only performed once here and not on the latency path of the first poll.
+    //This is as much of the setup as can be done ahead of a poll: ExecCircuit
+    //runs the setup phase (OT extension, garbling) and the online phase of a
+    //fully built circuit together, and the input gates of the circuit take
+    //their values when it is built, so the setup of a poll can neither start
+    //while its ballots arrive nor be generated for a size class in advance.
+    warm_up_party(party, circ, role);
+    //the offset is exchanged even if this server does not trace, as both
+    //servers have to take part in it
+    int64_t const clock_offset = exchange_clock_offset(party, circ, role);
+    if(!trace_file.empty()){
+        start_tracing(trace_file, role, role == SERVER ? "server 1" : "server 2");
+        set_trace_clock_offset(clock_offset);
+    }
+    std::vector<std::unique_ptr<ABYParty>> shard_parties;
+    std::vector<ABYParty*> shard_party_ptrs;
+    for(uint32_t i = 0; i < shards; ++i){
+        shard_parties.emplace_back(std::make_unique<ABYParty>(
+            role, const_cast<char*>(address.c_str()), port + 1 + i, sec_lvl, bitlen, nthreads, mt_alg
+        ));
+        shard_party_ptrs.emplace_back(shard_parties.back().get());
+        warm_up_party(*shard_parties.back(), shard_parties.back()->GetSharings()[sh]->GetCircuitBuildRoutine(), role);
+    }
+    
+    poll_queue<pending_poll> polls;
+    std::thread listener([&]{
+        uint32_t seq = 0;
+        while(true){
+            try{
+                ssl_server::session sess(s.listen());
+                auto const start = std::chrono::steady_clock::now();
+                doodle_table dt = read_poll(sess, rsa_data, decrypt_threads);
+                auto const end = std::chrono::steady_clock::now();
+                metrics.ballot_read.observe(std::chrono::duration<double>(end - start).count());
+                trace_complete("read_poll", start, end, poll_trace_args(uint64_t(1) << 32 | seq));
+                pending_poll pending{std::move(sess), std::move(dt), 0, seq++};
+                //the time to close includes receiving and decrypting the poll
+                pending.arrival = start;
+                polls.push(std::move(pending));
+            }
+            catch(std::exception const& e){
+                std::cerr << "error: " << e.what() << std::endl;
+            }
+        }
+    });
+    listener.detach();
+    
+    std::unique_ptr<metrics_endpoint> metrics_server;
+    if(metrics_port != 0){
+        metrics.registry.add_callback("sec_doodle_queue_depth", "Polls waiting for evaluation", "gauge", [&polls]{
+            return static_cast<double>(polls.size());
+        });
+        metrics.registry.add_callback("process_cpu_seconds_total", "User and system CPU time of the server", "counter", []{
+            rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+        });
+        metrics.registry.add_callback("process_resident_memory_bytes", "Resident memory of the server", "gauge", []{
+            return static_cast<double>(read_memory_usage().rss_bytes);
+        });
+        metrics.registry.add_callback("sec_doodle_peak_resident_memory_bytes", "Peak resident memory of the server", "gauge", []{
+            return static_cast<double>(read_memory_usage().peak_rss_bytes);
+        });
+        //only built with SEC_DOODLE_COUNT_ALLOCATIONS
+        if(allocation_counter const* const allocations = counted_allocations()){
+            metrics.registry.add_callback("sec_doodle_allocations_total", "Allocations of the server", "counter", [allocations]{
+                return static_cast<double>(allocations->allocations);
+            });
+            metrics.registry.add_callback("sec_doodle_allocated_bytes_total", "Bytes allocated by the server", "counter", [allocations]{
+                return static_cast<double>(allocations->allocated_bytes);
+            });
+            metrics.registry.add_callback("sec_doodle_live_allocated_bytes", "Bytes allocated and not yet freed", "gauge", [allocations]{
+                return static_cast<double>(allocations->live_bytes);
+            });
+        }
+        metrics_server = std::make_unique<metrics_endpoint>(metrics_port, metrics.registry);
+        std::thread([&]{ metrics_server->serve(); }).detach();
+    }
+    
+    std::unique_ptr<ssl_server> ingest_server;
+    poll_registry registry;
+    registry.log_directory = log_directory;
+    registry.max_participants = max_participants;
+    registry.max_time_slots = max_time_slots;
+    registry.recover();
+    if(ingest_port != 0){
+        ingest_server = std::make_unique<ssl_server>(ingest_port, private_key_filename, certificate_filename);
+        std::thread ingest_listener([&]{
+            while(true){
+                try{
+                    std::thread(
+                        [&](ssl_server::session sess){
+                            try{
+                                ingest_ballots(std::move(sess), rsa_data, registry, polls);
+                            }
+                            catch(std::exception const& e){
+                                std::cerr << "error: " << e.what() << std::endl;
+                            }
+                        },
+                        ingest_server->listen()
+                    ).detach();
+                }
+                catch(std::exception const& e){
+                    std::cerr << "error: " << e.what() << std::endl;
+                }
+            }
+        });
+        ingest_listener.detach();
+    }
+    
+    //large polls are sharded across the additional parties or evaluated in
+    //chunks, the others are evaluated together; both servers split the
+    //batch the same way as they hold tables of the same dimensions
+    //the results of a poll are its top_k best time slots with their no-sayers;
+    //sharding, chunks and batches only find the best one, so polls asking
+    //for more are ranked on their own
+    auto evaluate = [&](std::vector<pending_poll>& batch){
+        std::vector<std::vector<std::tuple<std::size_t, std::vector<bool>>>> results(batch.size());
+        std::vector<std::size_t> batched;
+        std::vector<doodle_table_view> dts;
+        for(std::size_t i = 0; i < batch.size(); ++i){
+            doodle_table_view const dt = batch[i].table();
+            for(auto const& sel : dt.entries){
+                std::cout << sel << " ";
+            }
+            std::cout << std::endl;
+            if(batch[i].encoding == ballot_encoding::additive){
+                results[i] = execute_circuit_additive(party, role, batch[i].top_k, batch[i].sums, dt);
+                party.Reset();
+            }
+            else if(batch[i].log){
+                results[i] = execute_circuit_incremental(
+                    party, role, algorithm::yao, batch[i].top_k,
+                    batch[i].carried_sums, batch[i].removed, batch[i].added, dt
+                );
+                party.Reset();
+            }
+            else if(batch[i].top_k > 1){
+                results[i] = execute_circuit_top_k(party, role, algorithm::yao, dt, batch[i].top_k);
+                party.Reset();
+            }
+            else if(!shard_party_ptrs.empty() && dt.num_rows * dt.num_columns >= shard_threshold){
+                results[i].emplace_back(execute_circuit_sharded(party, shard_party_ptrs, role, algorithm::yao, dt));
+                party.Reset();
+            }
+            else if(chunk_rows > 0 && dt.num_rows > chunk_rows){
+                results[i].emplace_back(execute_circuit_chunked(party, role, algorithm::yao, dt, chunk_rows));
+                party.Reset();
+            }
+            else{
+                batched.emplace_back(i);
+                dts.emplace_back(dt);
+            }
+        }
+        if(!dts.empty()){
+            auto batch_results = execute_circuit_batch(party, circ, role, algorithm::yao, dts);
+            party.Reset();
+            for(std::size_t i = 0; i < batched.size(); ++i){
+                results[batched[i]].emplace_back(std::move(batch_results[i]));
+            }
+        }
+        return results;
+    };
     
+    constexpr std::size_t growth_window = 16;
+    growth_tracker memory_growth(growth_window);
     while(true){
-        ssl_server::session sess(s.listen());
-        constexpr std::size_t buffer_size = RSA_keylength/8;
-        unsigned char input[buffer_size];
-        sess.read(input, 4);
-        
-        std::vector<doodle_entry> selections;
-        const unsigned int time_slots = input[0] << 24 | input[1] << 16 | input[2] << 8 | input[3];
-        unsigned int participants = 0;
-        while(sess.read(input, buffer_size) == buffer_size){
-            rsa_data.decrypt_message(selections, input, time_slots);
-            ++participants;
-        }
-        for(auto const& sel : selections){
-            std::cout << sel << " ";
-        }
-        std::cout << std::endl;
-        doodle_table dt(std::move(selections), participants, time_slots);
-        auto const tpl = execute_circuit(party, circ, role, algorithm::yao, dt);
-        party.Reset();
-        std::size_t const winner = std::get<0>(tpl);
-        std::vector<bool> const& nos = std::get<1>(tpl);
-        auto send_results = [&](unsigned char* const buf){
-            buf[0] = static_cast<unsigned char>(winner >> 24);
-            buf[1] = static_cast<unsigned char>(winner >> 16);
-            buf[2] = static_cast<unsigned char>(winner >> 8);
-            buf[3] = static_cast<unsigned char>(winner);
-        
-            auto it = nos.begin();
-            std::size_t buf_size = 4;
-            while(it != nos.end()){
-                auto const i = buf_size;
-                ++buf_size;
-                buf[i] = *it << 7;
-                ++it;
-                if(it == nos.end()) break;
-                buf[i] |= *it << 6;
-                ++it;
-                if(it == nos.end()) break;
-                buf[i] |= *it << 5;
-                ++it;
-                if(it == nos.end()) break;
-                buf[i] |= *it << 4;
-                ++it;
-                if(it == nos.end()) break;
-                buf[i] |= *it << 3;
-                ++it;
-                if(it == nos.end()) break;
-                buf[i] |= *it << 2;
-                ++it;
-                if(it == nos.end()) break;
-                buf[i] |= *it << 1;
-                ++it;
-                if(it == nos.end()) break;
-                buf[i] |= *it;
-                ++it;
-            }
-            std::cout << "data sent: " << sess.write(buf, buf_size) << std::endl;
-        };
-        
-        if(buffer_size > (4 + nos.size()/8)){
-            send_results(input);
+        std::vector<pending_poll> batch;
+        //the server decides which poll is evaluated next, as the servers may
+        //see the closing frames of ingested polls in different orders
+        uint64_t next_ticket = 0;
+        if(aging > 0){
+            //the server schedules the poll with the smallest estimated cost,
+            //reduced by aging per millisecond the poll has been waiting, so
+            //that small polls are not blocked by large ones and large ones
+            //are not starved
+            //the time is taken at the first score, after peek_min waited for
+            //a poll, so no poll is scored as arriving after now
+            std::chrono::steady_clock::time_point now;
+            auto const score = [&](pending_poll const& p){
+                if(now == std::chrono::steady_clock::time_point()){
+                    now = std::chrono::steady_clock::now();
+                }
+                auto const waited = std::chrono::duration_cast<std::chrono::milliseconds>(now - p.arrival).count();
+                return static_cast<double>(p.cost(algorithm::yao)) - static_cast<double>(aging) * waited;
+            };
+            uint64_t const proposal = role == SERVER ?
+                polls.peek_min(score, [](pending_poll const& p){ return p.ticket(); }) : 0;
+            next_ticket = agree_next_poll(party, circ, role, proposal);
+        }
+        else if(ingest_port != 0){
+            uint64_t const proposal = role == SERVER ? polls.peek([](pending_poll const& p){ return uint64_t(p.id); }) : 0;
+            next_ticket = agree_next_poll(party, circ, role, proposal);
+        }
+        if(next_ticket != 0){
+            batch.emplace_back(polls.pop_if([next_ticket](pending_poll const& p){ return p.ticket() == next_ticket; }));
         }
         else{
-            auto buf = std::make_unique<unsigned char[]>(4 + nos.size()/8);
-            send_results(buf.get());
+            //without a batching window both servers evaluate the polls one by one
+            //in the order they arrived, with a window they first agree on how many
+            //of the collected polls they both have
+            batch = polls.pop_batch(
+                batch_window > 0 ? std::max(max_batch, 1u) : 1u,
+                std::chrono::milliseconds(batch_window),
+                [](pending_poll const& p){ return p.id == 0; }
+            );
+            if(batch_window > 0){
+                std::size_t const n = agree_batch_size(party, circ, role, batch.size());
+                polls.push_front(std::make_move_iterator(batch.begin() + n), std::make_move_iterator(batch.end()));
+                batch.erase(batch.begin() + n, batch.end());
+            }
         }
         
-        std::cout << std::get<0>(tpl) << std::endl;
-        for(bool b : std::get<1>(tpl)){
-            std::cout << std::boolalpha << b << ", ";
+        auto const evaluation_start = std::chrono::steady_clock::now();
+        std::vector<std::vector<std::tuple<std::size_t, std::vector<bool>>>> results;
+        try{
+            results = evaluate(batch);
         }
-        std::cout << std::endl;
-        
+        catch(std::exception const& e){
+            //the polls of the batch are dropped, their connections closed
+            std::cerr << "error: evaluation failed: " << e.what() << std::endl;
+            party.Reset();
+            for(auto& p : batch){
+                if(p.failed){
+                    p.failed();
+                }
+            }
+            continue;
+        }
+        //all circuits of the batch are reset by now, so the memory in use
+        //should not grow from batch to batch; the allocated bytes show growth
+        //more precisely than the resident pages, if they are counted
+        memory_usage const after_reset = read_memory_usage();
+        metrics.resident_after_reset.observe(after_reset.rss_bytes);
+        if(memory_growth.add(counted_allocations() ? after_reset.live_bytes : after_reset.rss_bytes)){
+            metrics.memory_growth.add(1);
+            std::cerr << "warning: memory in use grew after each of the last " << growth_window
+                      << " batches, by " << memory_growth.growth() << " bytes" << std::endl;
+        }
+        if(tracing()){
+            std::string tickets;
+            for(auto const& p : batch){
+                tickets += (tickets.empty() ? "" : ", ") + std::to_string(p.ticket());
+            }
+            trace_complete("evaluate", evaluation_start, std::chrono::steady_clock::now(), "\"polls\": [" + tickets + "]");
+        }
+        for(std::size_t i = 0; i < batch.size(); ++i){
+            std::chrono::steady_clock::duration sending{0};
+            for(auto const& result : results[i]){
+                std::size_t const winner = std::get<0>(result);
+                std::vector<bool> const nos = batch[i].log ? 
+                    batch[i].log->participant_nos(std::get<1>(result)) : std::get<1>(result);
+                auto const send_start = std::chrono::steady_clock::now();
+                send_results(batch[i].sess, winner, nos);
+                auto const send_end = std::chrono::steady_clock::now();
+                sending += send_end - send_start;
+                trace_complete("send_results", send_start, send_end, poll_trace_args(batch[i].ticket()));
+                std::cout << winner << std::endl;
+                for(bool b : nos){
+                    std::cout << std::boolalpha << b << ", ";
+                }
+                std::cout << std::endl;
+            }
+            metrics.result_send.observe(std::chrono::duration<double>(sending).count());
+            metrics.poll_close.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - batch[i].arrival).count());
+            metrics.polls.add(1);
+            trace_complete("poll", batch[i].arrival, std::chrono::steady_clock::now(), poll_trace_args(batch[i].ticket()));
+            if(batch[i].done){
+                batch[i].done(std::move(batch[i].carried_sums));
+            }
+        }
+        flush_trace();
     }
     #endif
 	return 0;
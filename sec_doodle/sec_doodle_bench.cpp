@@ -0,0 +1,489 @@
+/**
+ \file 		sec_doodle_bench.cpp
+ \author	oliver.schick92@gmail.com
+ \copyright	ABY - A Framework for Efficient Mixed-protocol Secure Two-party Computation
+ Copyright (C) 2019 Engineering Cryptographic Protocols Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+            it under the terms of the GNU Lesser General Public License as published
+            by the Free Software Foundation, either version 3 of the License, or
+            (at your option) any later version.
+            ABY is distributed in the hope that it will be useful,
+            but WITHOUT ANY WARRANTY; without even the implied warranty of
+            MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+            GNU Lesser General Public License for more details.
+            You should have received a copy of the GNU Lesser General Public License
+            along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//Utility libs
+#include <ENCRYPTO_utils/crypto/crypto.h>
+#include <ENCRYPTO_utils/parse_options.h>
+//ABY Party class
+#include <abycore/aby/abyparty.h>
+#include <abycore/sharing/sharing.h>
+
+#include "common/sec_doodle.h"
+#include "common/net_relay.h"
+#include "common/memory.h"
+#include "common/table_corpus.h"
+
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <tuple>
+
+//median, 95th percentile (nearest rank) and standard deviation of a sample
+struct summary{
+    double median = 0, p95 = 0, stddev = 0;
+
+    explicit summary(std::vector<double> values){
+        if(values.empty()){
+            return;
+        }
+        std::sort(values.begin(), values.end());
+        std::size_t const n = values.size();
+        median = n % 2 == 1 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+        p95 = values[static_cast<std::size_t>(std::ceil(0.95 * n)) - 1];
+        double const mean = std::accumulate(values.begin(), values.end(), 0.0) / n;
+        double squares = 0;
+        for(double const v : values){
+            squares += (v - mean) * (v - mean);
+        }
+        stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
+    }
+};
+
+struct grid_point{
+    std::string variant;
+    std::size_t participants, time_slots, runs, errors;
+    std::vector<std::pair<char const*, summary>> metrics;
+    //the live memory grew after every one of the last runs, see growth_tracker
+    bool memory_growth;
+};
+
+//collects the samples of the metrics of a grid point in the order they are added
+struct samples{
+    std::vector<std::pair<char const*, std::vector<double>>> values;
+
+    void add(char const* metric, double const value){
+        auto it = std::find_if(values.begin(), values.end(), [&](auto const& v){
+            return std::strcmp(v.first, metric) == 0;
+        });
+        if(it == values.end()){
+            values.emplace_back(metric, std::vector<double>());
+            it = values.end() - 1;
+        }
+        it->second.emplace_back(value);
+    }
+
+    std::vector<std::pair<char const*, summary>> summarize() const{
+        std::vector<std::pair<char const*, summary>> metrics;
+        for(auto const& v : values){
+            metrics.emplace_back(v.first, summary(v.second));
+        }
+        return metrics;
+    }
+};
+
+std::vector<std::size_t> parse_sizes(std::string const& list){
+    std::vector<std::size_t> sizes;
+    std::istringstream is(list);
+    std::string item;
+    while(std::getline(is, item, ',')){
+        std::size_t pos = 0;
+        unsigned long const size = std::stoul(item, &pos);
+        if(pos != item.size() || size == 0){
+            throw std::runtime_error("invalid size " + item);
+        }
+        sizes.emplace_back(size);
+    }
+    return sizes;
+}
+
+char const* algorithm_name(algorithm const alg){
+    switch(alg){
+    case algorithm::gmw: return "gmw";
+    case algorithm::yao: return "yao";
+    case algorithm::gmw_weighted: return "gmw_weighted";
+    case algorithm::yao_weighted: return "yao_weighted";
+    }
+    return "";
+}
+
+std::vector<std::string> parse_names(std::string const& list, std::vector<std::string> const& known){
+    std::vector<std::string> names;
+    std::istringstream is(list);
+    std::string item;
+    while(std::getline(is, item, ',')){
+        if(std::find(known.begin(), known.end(), item) == known.end()){
+            throw std::runtime_error("unknown algorithm " + item);
+        }
+        names.emplace_back(item);
+    }
+    return names;
+}
+
+void write_json(std::ostream& os, std::vector<grid_point> const& points){
+    os << "[\n";
+    for(std::size_t i = 0; i < points.size(); ++i){
+        grid_point const& p = points[i];
+        os << "  {\"algorithm\": \"" << p.variant << '"'
+           << ", \"participants\": " << p.participants
+           << ", \"time_slots\": " << p.time_slots
+           << ", \"runs\": " << p.runs
+           << ", \"errors\": " << p.errors
+           << ", \"memory_growth\": " << std::boolalpha << p.memory_growth;
+        for(auto const& m : p.metrics){
+            os << ", \"" << m.first << "\": {\"median\": " << m.second.median
+               << ", \"p95\": " << m.second.p95 << ", \"stddev\": " << m.second.stddev << '}';
+        }
+        os << (i + 1 == points.size() ? "}\n" : "},\n");
+    }
+    os << "]\n";
+}
+
+//all points have the metrics of the first one
+void write_csv(std::ostream& os, std::vector<grid_point> const& points){
+    os << "algorithm,participants,time_slots,runs,errors,memory_growth";
+    if(!points.empty()){
+        for(auto const& m : points.front().metrics){
+            os << ',' << m.first << "_median," << m.first << "_p95," << m.first << "_stddev";
+        }
+    }
+    os << '\n';
+    for(grid_point const& p : points){
+        os << p.variant << ',' << p.participants << ',' << p.time_slots
+           << ',' << p.runs << ',' << p.errors << ',' << p.memory_growth;
+        for(auto const& m : p.metrics){
+            os << ',' << m.second.median << ',' << m.second.p95 << ',' << m.second.stddev;
+        }
+        os << '\n';
+    }
+}
+
+int32_t read_bench_options(int32_t* argcp, char*** argvp, e_role* role,
+		uint32_t* secparam, std::string* address, uint16_t* port,
+		std::string* participants, std::string* time_slots, std::string* algorithms,
+		uint32_t* runs, uint32_t* warm_ups, uint32_t* seed, std::string* format,
+		std::string* output, bool* check, bool* construction_only, bool* loopback,
+		std::string* network, std::string* gate_stats, std::string* corpus,
+		bool* write_corpus, uint32_t* corpus_threads) {
+
+	uint32_t int_role = 2, int_port = 0;
+
+	parsing_ctx options[] =
+			{ { (void*) &int_role, T_NUM, "r", "Role: 0/1, not needed with -l", false, false }, {
+					(void*) secparam, T_NUM, "s",
+					"Symmetric Security Bits, default: 128", false, false }, {
+					(void*) address, T_STR, "a",
+					"IP-address, default: localhost", false, false }, {
+					(void*) &int_port, T_NUM, "p", "Port, default: 7766", false,
+					false }, { (void*) participants, T_STR, "P",
+					"Comma separated numbers of participants, default: 10,100,1000,10000",
+					false, false }, { (void*) time_slots, T_STR, "T",
+					"Comma separated numbers of time slots, default: 10,20,30",
+					false, false }, { (void*) algorithms, T_STR, "A",
+					"Comma separated algorithms out of gmw, yao, gmw_weighted, yao_weighted, default: all",
+					false, false }, { (void*) runs, T_NUM, "R",
+					"Measured runs per poll shape, default: 10", false,
+					false }, { (void*) warm_ups, T_NUM, "W",
+					"Unmeasured runs before the measured ones, default: 1", false,
+					false }, { (void*) seed, T_NUM, "x",
+					"Seed of the generated polls, has to be the same for both parties, default: 1",
+					false, false }, { (void*) format, T_STR, "f",
+					"Output format, json or csv, default: json", false,
+					false }, { (void*) output, T_STR, "o",
+					"Output file, default: standard output", false,
+					false }, { (void*) check, T_FLAG, "c",
+					"Check every result against a cleartext evaluation, default: off",
+					false, false }, { (void*) construction_only, T_FLAG, "B",
+					"Only measure building the circuits, without a second party; -A then selects out of the variants gmw, yao, gmw_weighted, yao_weighted, gmw_hybrid, yao_hybrid, gmw_weighted_hybrid, yao_weighted_hybrid, arith_gmw, arith_yao, gmw_arith_yao, default: off",
+					false, false }, { (void*) loopback, T_FLAG, "l",
+					"Run both parties in this process, connected over loopback, default: off",
+					false, false }, { (void*) network, T_STR, "N",
+					"Emulated network between the parties, lan, metro, wan or rtt_ms,mbit[,jitter_ms], has to be given to both parties, default: none",
+					false, false }, { (void*) gate_stats, T_STR, "G",
+					"With -B, file the gates of the stages of the last measured circuit of every poll shape are written to as JSON, slows down the construction, default: none",
+					false, false }, { (void*) corpus, T_STR, "C",
+					"Corpus file the polls are read from instead of generating them, default: none",
+					false, false }, { (void*) write_corpus, T_FLAG, "w",
+					"Write the polls of the grid to the corpus file of -C and exit, without a second party, default: off",
+					false, false }, { (void*) corpus_threads, T_NUM, "j",
+					"Threads generating the polls with -w, default: number of cores",
+					false, false } };
+
+	if (!parse_options(argcp, argvp, options,
+			sizeof(options) / sizeof(parsing_ctx))
+			|| (int_role >= 2 && !*loopback && !*construction_only && !*write_corpus)
+			|| (*write_corpus && corpus->empty())) {
+		print_usage(*argvp[0], options, sizeof(options) / sizeof(parsing_ctx));
+		std::cout << "Exiting" << std::endl;
+		exit(0);
+	}
+
+	*role = int_role < 2 ? (e_role) int_role : SERVER;
+
+	if (int_port != 0) {
+		assert(int_port < 1 << (sizeof(uint16_t) * 8));
+		*port = (uint16_t) int_port;
+	}
+
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	e_role role;
+	uint32_t bitlen = 64, secparam = 128, nthreads = 1;
+	uint16_t port = 7766;
+	std::string address = "127.0.0.1";
+	e_mt_gen_alg mt_alg = MT_OT;
+	std::string participants = "10,100,1000,10000", time_slots = "10,20,30",
+	            algorithms, format = "json", output, network, gate_stats, corpus;
+	uint32_t runs = 10, warm_ups = 1, seed = 1, corpus_threads = std::thread::hardware_concurrency();
+	bool check = false, construction_only = false, loopback = false, write_corpus = false;
+
+	read_bench_options(&argc, &argv, &role, &secparam, &address, &port, &participants,
+			&time_slots, &algorithms, &runs, &warm_ups, &seed, &format, &output, &check,
+			&construction_only, &loopback, &network, &gate_stats, &corpus, &write_corpus,
+			&corpus_threads);
+
+    if(format != "json" && format != "csv"){
+        std::cerr << "unknown output format " << format << std::endl;
+        return 1;
+    }
+    std::vector<std::size_t> const participant_sizes = parse_sizes(participants);
+    std::vector<std::size_t> const time_slot_sizes = parse_sizes(time_slots);
+    std::vector<std::string> executed;
+    for(algorithm const alg : {algorithm::gmw, algorithm::yao, algorithm::gmw_weighted, algorithm::yao_weighted}){
+        executed.emplace_back(algorithm_name(alg));
+    }
+    std::vector<std::string> const& known = construction_only ? circuit_variants() : executed;
+    std::vector<std::string> const selected = algorithms.empty() ? known : parse_names(algorithms, known);
+    //only the arithmetic variants of -B are built on arithmetic tables
+    auto poll_of = [&](std::string const& variant, std::size_t const p, std::size_t const t, uint32_t const poll_seed){
+        return corpus_poll{poll_seed, p, t, construction_only && variant.compare(0, 6, "arith_") == 0};
+    };
+
+    if(write_corpus){
+        //the polls of the grid in the order it is walked below
+        std::vector<corpus_poll> polls;
+        uint32_t poll_seed = seed;
+        for(std::string const& variant : selected){
+            for(std::size_t const t : time_slot_sizes){
+                for(std::size_t const p : participant_sizes){
+                    for(uint32_t i = 0; i < warm_ups + runs; ++i){
+                        polls.emplace_back(poll_of(variant, p, t, poll_seed++));
+                    }
+                }
+            }
+        }
+        write_table_corpus(corpus, polls, corpus_threads);
+        std::cerr << "wrote " << table_corpus(corpus).size() << " polls to " << corpus << std::endl;
+        return 0;
+    }
+    std::unique_ptr<table_corpus> polls;
+    if(!corpus.empty()){
+        polls = std::make_unique<table_corpus>(corpus);
+    }
+
+    loopback = loopback && !construction_only;
+    if(loopback){
+        address = "127.0.0.1";
+    }
+    //the server side starts a relay on port + 1 that emulates the network,
+    //the client connects to it instead of the server
+    std::unique_ptr<net_relay> relay;
+    if(!network.empty() && !construction_only && (loopback || role == SERVER)){
+        relay = std::make_unique<net_relay>(port + 1, address, port, parse_net_profile(network));
+    }
+    //parties[r] is the party of role r, with loopback both are in this process
+    std::unique_ptr<ABYParty> parties[2];
+    auto set_up_party = [&](e_role const r){
+        uint16_t const party_port = !network.empty() && r == CLIENT ? port + 1 : port;
+        parties[r] = std::make_unique<ABYParty>(r, const_cast<char*>(address.c_str()), party_port, get_sec_lvl(secparam), bitlen, nthreads, mt_alg);
+        if(!construction_only){
+            warm_up_party(*parties[r], parties[r]->GetSharings()[S_YAO]->GetCircuitBuildRoutine(), r);
+        }
+    };
+    if(loopback){
+        run_both_roles(set_up_party);
+    }
+    else{
+        set_up_party(role);
+    }
+
+    //gates of the stages of the last circuit built, see -G
+    std::vector<circuit_stage_stats> stages;
+    //runs one evaluation (or construction) of a poll and adds its measurements
+    auto measure = [&](std::string const& variant, std::size_t const p, std::size_t const t, uint32_t const poll_seed, samples& sample){
+        if(construction_only){
+            //only built with SEC_DOODLE_COUNT_ALLOCATIONS
+            allocation_counter* const allocation_count = counted_allocations();
+            if(allocation_count != nullptr){
+                allocation_count->reset();
+            }
+            construction_stats stats;
+            if(polls){
+                doodle_table_view dt, alice_dt, bob_dt;
+                std::tie(dt, alice_dt, bob_dt) = polls->tables(poll_of(variant, p, t, poll_seed));
+                stats = measure_construction(*parties[role], role, variant, role == SERVER ? bob_dt : alice_dt, !gate_stats.empty());
+            }
+            else{
+                stats = measure_construction(*parties[role], role, variant, p, t, poll_seed, !gate_stats.empty());
+            }
+            stages = stats.stages;
+            sample.add("input_ms", stats.input_ms);
+            sample.add("column_sums_ms", stats.column_sums_ms);
+            sample.add("no_retrieval_ms", stats.no_retrieval_ms);
+            sample.add("gates", stats.gates);
+            sample.add("circuit_rss_bytes", stats.circuit_rss_bytes);
+            if(allocation_count != nullptr){
+                sample.add("allocations", allocation_count->allocations);
+                sample.add("allocated_bytes", allocation_count->allocated_bytes);
+                sample.add("peak_bytes", allocation_count->peak_bytes);
+            }
+            return true;
+        }
+        algorithm const alg = static_cast<algorithm>(
+            std::find(executed.begin(), executed.end(), variant) - executed.begin()
+        );
+        doodle_table generated[3];
+        doodle_table_view dt, alice_dt, bob_dt;
+        if(polls){
+            std::tie(dt, alice_dt, bob_dt) = polls->tables(poll_of(variant, p, t, poll_seed));
+        }
+        else{
+            std::tie(generated[0], generated[1], generated[2]) = generate_tables(p, t, false, poll_seed);
+            dt = generated[0];
+            alice_dt = generated[1];
+            bob_dt = generated[2];
+        }
+        execution_stats stats[2];
+        auto evaluate = [&](e_role const r){
+            stats[r] = benchmark_circuit(
+                *parties[r], r, alg,
+                r == SERVER ? bob_dt : alice_dt,
+                check ? dt : doodle_table_view()
+            );
+        };
+        if(loopback){
+            run_both_roles(evaluate);
+            //an evaluation takes as long as its slower party, the traffic of
+            //the server covers both directions
+            stats[SERVER].setup_ms = std::max(stats[SERVER].setup_ms, stats[CLIENT].setup_ms);
+            stats[SERVER].online_ms = std::max(stats[SERVER].online_ms, stats[CLIENT].online_ms);
+            stats[SERVER].correct = stats[SERVER].correct && stats[CLIENT].correct;
+        }
+        else{
+            evaluate(role);
+        }
+        execution_stats const& combined = stats[loopback ? SERVER : role];
+        sample.add("setup_ms", combined.setup_ms);
+        sample.add("online_ms", combined.online_ms);
+        sample.add("sent_bytes", combined.sent_bytes);
+        sample.add("received_bytes", combined.received_bytes);
+        sample.add("rounds", combined.rounds);
+        sample.add("phase_rss_bytes", combined.phase_rss_bytes);
+        return !combined.checked || combined.correct;
+    };
+
+    std::vector<grid_point> points;
+    std::ofstream gate_stats_file;
+    if(construction_only && !gate_stats.empty()){
+        gate_stats_file.open(gate_stats);
+        if(!gate_stats_file){
+            std::cerr << "cannot open " << gate_stats << std::endl;
+            return 1;
+        }
+        gate_stats_file << "[\n";
+    }
+    //both parties walk the grid in the same order, so they generate the same
+    //polls from the same seeds
+    uint32_t poll_seed = seed;
+    for(std::string const& variant : selected){
+        for(std::size_t const t : time_slot_sizes){
+            for(std::size_t const p : participant_sizes){
+                samples warm_up_sample, sample;
+                std::size_t errors = 0;
+                growth_tracker growth(std::min<uint32_t>(std::max(runs, 2u) - 1, 8));
+                bool memory_growth = false;
+                uint64_t grown_bytes = 0;
+                for(uint32_t i = 0; i < warm_ups + runs; ++i){
+                    samples& run_sample = i < warm_ups ? warm_up_sample : sample;
+                    if(!measure(variant, p, t, poll_seed++, run_sample) && i >= warm_ups){
+                        std::cerr << "error: wrong result for " << variant
+                                  << " p=" << p << " t=" << t << " seed=" << poll_seed - 1 << std::endl;
+                        ++errors;
+                    }
+                    //the circuits are reset after every run, the memory still
+                    //in use should not grow from run to run
+                    memory_usage const after_reset = read_memory_usage();
+                    run_sample.add("rss_after_reset_bytes", after_reset.rss_bytes);
+                    run_sample.add("peak_rss_bytes", after_reset.peak_rss_bytes);
+                    //without counted allocations the resident memory has to do, as
+                    //the server does
+                    bool const counted = counted_allocations() != nullptr;
+                    if(counted){
+                        run_sample.add("live_bytes", after_reset.live_bytes);
+                    }
+                    if(i >= warm_ups && growth.add(counted ? after_reset.live_bytes : after_reset.rss_bytes)){
+                        memory_growth = true;
+                        grown_bytes = growth.growth();
+                    }
+                }
+                if(memory_growth){
+                    std::cerr << "warning: memory in use grew after every run of " << variant
+                              << " p=" << p << " t=" << t << ", by " << grown_bytes << " bytes in total" << std::endl;
+                }
+                points.emplace_back(grid_point{variant, p, t, runs, errors, sample.summarize(), memory_growth});
+                if(gate_stats_file.is_open()){
+                    gate_stats_file << (points.size() == 1 ? "" : ",\n")
+                                    << "  {\"algorithm\": \"" << variant << '"'
+                                    << ", \"participants\": " << p
+                                    << ", \"time_slots\": " << t
+                                    << ", \"stages\": ";
+                    write_circuit_report(gate_stats_file, stages);
+                    gate_stats_file << '}';
+                }
+                std::cerr << variant << ": measured p=" << p << " t=" << t << std::endl;
+            }
+        }
+    }
+
+    if(gate_stats_file.is_open()){
+        gate_stats_file << "\n]\n";
+    }
+
+    std::ofstream of;
+    if(!output.empty()){
+        of.open(output);
+        if(!of){
+            std::cerr << "cannot open " << output << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& os = output.empty() ? std::cout : of;
+    if(format == "json"){
+        write_json(os, points);
+    }
+    else{
+        write_csv(os, points);
+    }
+    bool const failed = std::any_of(points.begin(), points.end(), [](grid_point const& p){
+        return p.errors != 0;
+    });
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,685 @@
+/**
+ \file 		sec_doodle_load.cpp
+ \author	oliver.schick92@gmail.com
+ \copyright	ABY - A Framework for Efficient Mixed-protocol Secure Two-party Computation
+ Copyright (C) 2019 Engineering Cryptographic Protocols Group, TU Darmstadt
+			This program is free software: you can redistribute it and/or modify
+            it under the terms of the GNU Lesser General Public License as published
+            by the Free Software Foundation, either version 3 of the License, or
+            (at your option) any later version.
+            ABY is distributed in the hope that it will be useful,
+            but WITHOUT ANY WARRANTY; without even the implied warranty of
+            MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+            GNU Lesser General Public License for more details.
+            You should have received a copy of the GNU Lesser General Public License
+            along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//Utility libs
+#include <ENCRYPTO_utils/parse_options.h>
+
+#include "common/sec_doodle.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+using load_clock = std::chrono::steady_clock;
+
+std::string openssl_error(){
+    std::string result;
+    ERR_print_errors_cb(
+        [](const char* err_str, std::size_t len, void* str){
+            std::string& s = *static_cast<std::string*>(str);
+            s.reserve(s.size() + len);
+            s += err_str;
+            return 0;
+        },
+        static_cast<void*>(&result)
+    );
+    return result;
+}
+
+//public key of a server, read from its certificate, the ballots sent to the
+//server are encrypted with
+struct rsa_public_key{
+    RSA* rsa;
+    explicit rsa_public_key(char const* const certificate_file)
+    : rsa(nullptr){
+        BIO* const pub = BIO_new_file(certificate_file, "r");
+        if(pub == nullptr){
+            throw std::runtime_error(std::string("could not open certificate file:\n") + openssl_error());
+        }
+        X509* const cert = PEM_read_bio_X509(pub, nullptr, nullptr, nullptr);
+        BIO_free(pub);
+        if(cert == nullptr){
+            throw std::runtime_error(std::string("could not read certificate:\n") + openssl_error());
+        }
+        EVP_PKEY* const key = X509_get_pubkey(cert);
+        if(key != nullptr){
+            rsa = EVP_PKEY_get1_RSA(key);
+            EVP_PKEY_free(key);
+        }
+        X509_free(cert);
+        if(rsa == nullptr){
+            throw std::runtime_error(std::string("could not read public key:\n") + openssl_error());
+        }
+    }
+    rsa_public_key(rsa_public_key const&) = delete;
+    rsa_public_key& operator=(rsa_public_key const&) = delete;
+    ~rsa_public_key(){
+        RSA_free(rsa);
+    }
+    //PKCS #1 v1.5 as the RSAKey of the front-end, may be called concurrently
+    //from several threads
+    void encrypt(std::vector<unsigned char>& result, std::string const& message) const{
+        std::size_t const offset = result.size();
+        result.resize(offset + RSA_size(rsa));
+        int const length = RSA_public_encrypt(
+            message.size(), reinterpret_cast<unsigned char const*>(message.data()),
+            result.data() + offset, rsa, RSA_PKCS1_PADDING
+        );
+        if(length != RSA_size(rsa)){
+            throw std::runtime_error("could not encrypt ballot:\n" + openssl_error());
+        }
+    }
+};
+
+//the selections of a row as the front-end compresses them before encrypting
+//them, three 2 bit entries per base64 character
+std::string compress_selections(doodle_entry const* const row, std::size_t const time_slots){
+    static char const base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string result;
+    result.reserve((time_slots + 2) / 3);
+    for(std::size_t i = 0; i < time_slots; i += 3){
+        unsigned c = (row[i] & 0x3) << 4;
+        if(i + 1 < time_slots){
+            c |= (row[i + 1] & 0x3) << 2;
+        }
+        if(i + 2 < time_slots){
+            c |= row[i + 2] & 0x3;
+        }
+        result += base64[c];
+    }
+    return result;
+}
+
+//client side of a TLS connection to one of the servers, the server only
+//completes the handshake once it has read all polls that connected before
+struct tls_connection{
+    tls_connection(SSL_CTX* const ctx, std::string const& address, uint16_t const port)
+    : socket_(connect_(address, port)), ssl_(SSL_new(ctx)){
+        if(ssl_ == nullptr){
+            close(socket_);
+            throw std::runtime_error("could not create ssl:\n" + openssl_error());
+        }
+        SSL_set_fd(ssl_, socket_);
+    }
+
+    tls_connection(tls_connection const&) = delete;
+    tls_connection& operator=(tls_connection const&) = delete;
+
+    ~tls_connection() noexcept{
+        SSL_free(ssl_);
+        close(socket_);
+    }
+
+    void handshake(){
+        if(SSL_connect(ssl_) <= 0){
+            throw std::runtime_error("could not securely connect to server\n" + openssl_error());
+        }
+    }
+
+    //writes buffer as a single record, buffer_size must not exceed 16 KiB
+    void write_record(void const* const buffer, std::size_t const buffer_size){
+        if(SSL_write(ssl_, buffer, buffer_size) != static_cast<int>(buffer_size)){
+            throw std::runtime_error("could not send poll\n" + openssl_error());
+        }
+    }
+
+    //ends the poll, the connection stays open for the results
+    void finish_writing(){
+        SSL_shutdown(ssl_);
+    }
+
+    //reads exactly buffer_size bytes unless the connection ends before
+    bool read_all(void* const buffer, std::size_t const buffer_size){
+        std::size_t received = 0;
+        while(received < buffer_size){
+            int const n = SSL_read(ssl_, static_cast<unsigned char*>(buffer) + received, buffer_size - received);
+            if(n <= 0){
+                return false;
+            }
+            received += n;
+        }
+        return true;
+    }
+
+private:
+    static int connect_(std::string const& address, uint16_t const port){
+        addrinfo hints{};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* info = nullptr;
+        if(getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &info) != 0){
+            throw std::runtime_error("could not resolve " + address);
+        }
+        int const s = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        if(s < 0 || connect(s, info->ai_addr, info->ai_addrlen) < 0){
+            if(s >= 0){
+                close(s);
+            }
+            freeaddrinfo(info);
+            throw std::runtime_error("could not connect to " + address + ":" + std::to_string(port));
+        }
+        freeaddrinfo(info);
+        //the records are complete when written, so waiting for further data
+        //would only delay them
+        int const no_delay = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+        return s;
+    }
+
+    int socket_;
+    SSL* ssl_;
+};
+
+//TLS context trusting only the certificate of one server, as the front-end
+struct tls_context{
+    SSL_CTX* ctx;
+    explicit tls_context(char const* const certificate_file)
+    : ctx(SSL_CTX_new(SSLv23_client_method())){
+        if(ctx == nullptr){
+            throw std::runtime_error("could not create SSL context:\n" + openssl_error());
+        }
+        if(SSL_CTX_load_verify_locations(ctx, certificate_file, nullptr) <= 0){
+            SSL_CTX_free(ctx);
+            throw std::runtime_error(std::string("could not open certificate file:\n") + openssl_error());
+        }
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+    }
+    tls_context(tls_context const&) = delete;
+    tls_context& operator=(tls_context const&) = delete;
+    ~tls_context(){
+        SSL_CTX_free(ctx);
+    }
+};
+
+//a server of the poll evaluation, as seen by the front-end
+struct endpoint{
+    std::string address;
+    uint16_t port;
+    tls_context tls;
+    rsa_public_key key;
+
+    endpoint(std::string address, uint16_t const port, char const* const certificate_file)
+    : address(std::move(address)), port(port), tls(certificate_file), key(certificate_file) {}
+};
+
+//Lets the polls connect to the servers in the order of their numbers: the
+//servers pair the polls they receive by the order they arrive in.
+class connection_order{
+public:
+    explicit connection_order(std::size_t const num_polls)
+    : released_(num_polls, false) {}
+
+    //throws once the pairing is lost, see lose_pairing
+    void wait_turn(std::size_t const poll){
+        std::unique_lock<std::mutex> lock(m_);
+        cv_.wait(lock, [&]{ return next_ == poll; });
+        if(lost_by_ < released_.size()){
+            throw std::runtime_error("not sent, the servers lost the pairing at poll " + std::to_string(lost_by_));
+        }
+    }
+
+    //the servers received different polls for poll, e.g. as only one of them
+    //could be reached; the legacy endpoint cannot withdraw a poll, so the
+    //following polls would be paired wrongly and are not sent any more
+    void lose_pairing(std::size_t const poll){
+        std::lock_guard<std::mutex> lock(m_);
+        lost_by_ = std::min(lost_by_, poll);
+    }
+
+    bool pairing_lost(){
+        std::lock_guard<std::mutex> lock(m_);
+        return lost_by_ < released_.size();
+    }
+
+    //lets the following poll connect, may be called several times and before
+    //the turn of poll, e.g. when the poll failed
+    void release(std::size_t const poll){
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            released_[poll] = true;
+            while(next_ < released_.size() && released_[next_]){
+                ++next_;
+            }
+        }
+        cv_.notify_all();
+    }
+
+private:
+    std::mutex m_;
+    std::condition_variable cv_;
+    std::vector<bool> released_;
+    std::size_t next_ = 0;
+    std::size_t lost_by_ = std::numeric_limits<std::size_t>::max();
+};
+
+//a poll shape of the size mix and its share of the generated polls
+struct poll_shape{
+    std::size_t participants, time_slots;
+    double weight;
+};
+
+//parses a comma separated list of participants x time slots[:weight]
+std::vector<poll_shape> parse_mix(std::string const& mix){
+    std::vector<poll_shape> shapes;
+    std::istringstream is(mix);
+    std::string item;
+    while(std::getline(is, item, ',')){
+        std::istringstream item_is(item);
+        poll_shape shape{0, 0, 1};
+        char x = 0, colon = ':';
+        if(!(item_is >> shape.participants >> x >> shape.time_slots) || x != 'x'
+            || (item_is >> colon && (colon != ':' || !(item_is >> shape.weight)))
+            || shape.participants == 0 || shape.time_slots == 0 || shape.weight <= 0){
+            throw std::runtime_error("invalid poll shape " + item);
+        }
+        shapes.emplace_back(shape);
+    }
+    if(shapes.empty()){
+        throw std::runtime_error("empty size mix");
+    }
+    return shapes;
+}
+
+struct poll_outcome{
+    std::size_t shape = 0;
+    //from the time the poll was due (or ready, if it was late) to its result
+    double latency_ms = 0;
+    //the poll was not ready to be sent at its due time
+    bool late = false;
+    //no result was received
+    bool failed = false;
+    bool correct = false;
+};
+
+//the ballots of a poll as sent to one server: the number of time slots and
+//one encrypted block per participant
+std::vector<unsigned char> encrypt_poll(doodle_table const& dt, rsa_public_key const& key){
+    std::vector<unsigned char> message{
+        static_cast<unsigned char>(dt.num_columns >> 24), static_cast<unsigned char>(dt.num_columns >> 16),
+        static_cast<unsigned char>(dt.num_columns >> 8), static_cast<unsigned char>(dt.num_columns)
+    };
+    message.reserve(4 + dt.num_rows * RSA_size(key.rsa));
+    for(std::size_t i = 0; i < dt.num_rows; ++i){
+        key.encrypt(message, compress_selections(dt.entries.data() + i * dt.num_columns, dt.num_columns));
+    }
+    return message;
+}
+
+//The server reads the number of time slots and then the ballots block by
+//block, so no read may span two records: the header is a record of its own
+//and the ballots follow in records of whole blocks.
+void send_poll(tls_connection& conn, std::vector<unsigned char> const& message, std::size_t const block_size){
+    std::size_t const record_size = (16 * 1024 / block_size) * block_size;
+    conn.write_record(message.data(), 4);
+    for(std::size_t sent = 4; sent < message.size(); sent += record_size){
+        conn.write_record(message.data() + sent, std::min(record_size, message.size() - sent));
+    }
+    conn.finish_writing();
+}
+
+//generates, sends and checks poll number poll at due, the first server
+//receives the masked and the second server the random shares of the poll
+poll_outcome run_poll(
+    std::size_t const poll,
+    poll_shape const& shape,
+    uint32_t const poll_seed,
+    load_clock::time_point const due,
+    endpoint& server1,
+    endpoint& server2,
+    connection_order& order
+){
+    poll_outcome outcome;
+    doodle_table dt, random_dt, masked_dt;
+    std::tie(dt, random_dt, masked_dt) = generate_tables(shape.participants, shape.time_slots, false, poll_seed);
+    //the rows are random already, so unlike the front-end the load generator
+    //does not shuffle them
+    std::vector<unsigned char> const masked = encrypt_poll(masked_dt, server1.key);
+    std::vector<unsigned char> const random = encrypt_poll(random_dt, server2.key);
+    circuit_simulation const expected = simulate_circuit(algorithm::yao, dt);
+
+    load_clock::time_point const ready = load_clock::now();
+    outcome.late = ready > due;
+    std::this_thread::sleep_until(due);
+    load_clock::time_point const start = std::max(due, ready);
+
+    order.wait_turn(poll);
+    std::unique_ptr<tls_connection> to_server1, to_server2;
+    try{
+        to_server1 = std::make_unique<tls_connection>(server1.tls.ctx, server1.address, server1.port);
+        to_server1->handshake();
+    }
+    catch(...){
+        order.release(poll);
+        throw;
+    }
+    //server 1 takes the connection as a poll whatever it receives from now
+    //on, so server 2 has to get this poll as well before the next one connects
+    int const attempts = 3;
+    for(int attempt = 1; !to_server2; ++attempt){
+        try{
+            to_server2 = std::make_unique<tls_connection>(server2.tls.ctx, server2.address, server2.port);
+            to_server2->handshake();
+        }
+        catch(std::runtime_error const& re){
+            to_server2.reset();
+            if(attempt == attempts){
+                order.lose_pairing(poll);
+                order.release(poll);
+                throw;
+            }
+            std::cerr << "error: poll " << poll << ": " << re.what() << ", reconnecting" << std::endl;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100 * attempt));
+        }
+    }
+    order.release(poll);
+    try{
+        send_poll(*to_server1, masked, RSA_size(server1.key.rsa));
+        send_poll(*to_server2, random, RSA_size(server2.key.rsa));
+    }
+    catch(...){
+        //the servers evaluate whatever part of the poll they received
+        order.lose_pairing(poll);
+        throw;
+    }
+
+    //the first server sends the winning time slot and the no-sayers, the
+    //second one only the winning time slot
+    std::vector<unsigned char> result1(4 + (shape.participants + 7) / 8);
+    unsigned char result2[4];
+    if(!to_server1->read_all(result1.data(), result1.size()) || !to_server2->read_all(result2, 4)){
+        throw std::runtime_error("server closed the connection before sending the result");
+    }
+    outcome.latency_ms = std::chrono::duration<double, std::milli>(load_clock::now() - start).count();
+    auto const read_winner = [](unsigned char const* const buf){
+        return static_cast<std::size_t>(buf[0]) << 24 | buf[1] << 16 | buf[2] << 8 | buf[3];
+    };
+    outcome.correct = read_winner(result1.data()) == expected.best_column
+                      && read_winner(result2) == expected.best_column;
+    for(std::size_t i = 0; i < shape.participants && outcome.correct; ++i){
+        outcome.correct = static_cast<bool>(result1[4 + i / 8] >> (7 - i % 8) & 1) == expected.nos[i];
+    }
+    return outcome;
+}
+
+//latency percentiles (nearest rank) and the histogram of the latencies in
+//buckets with the upper bounds 1, 2, 4, ... ms
+struct latency_summary{
+    double min = 0, median = 0, p95 = 0, p99 = 0, max = 0;
+    std::vector<std::size_t> histogram;
+
+    explicit latency_summary(std::vector<double> values){
+        if(values.empty()){
+            return;
+        }
+        std::sort(values.begin(), values.end());
+        std::size_t const n = values.size();
+        auto const percentile = [&](double const p){
+            return values[std::max<std::size_t>(1, static_cast<std::size_t>(std::ceil(p * n))) - 1];
+        };
+        min = values.front();
+        median = percentile(0.5);
+        p95 = percentile(0.95);
+        p99 = percentile(0.99);
+        max = values.back();
+        for(double const v : values){
+            std::size_t bucket = 0;
+            while(std::ldexp(1.0, bucket) < v){
+                ++bucket;
+            }
+            histogram.resize(std::max(histogram.size(), bucket + 1), 0);
+            ++histogram[bucket];
+        }
+    }
+};
+
+struct shape_report{
+    poll_shape shape;
+    std::size_t polls, errors, late;
+    latency_summary latency;
+};
+
+void write_json(std::ostream& os, std::vector<shape_report> const& reports, std::size_t const polls,
+                std::size_t const errors, double const duration_s){
+    os << "{\"polls\": " << polls << ", \"errors\": " << errors
+       << ", \"duration_s\": " << duration_s
+       << ", \"throughput\": " << (duration_s > 0 ? polls / duration_s : 0) << ", \"shapes\": [\n";
+    for(std::size_t i = 0; i < reports.size(); ++i){
+        shape_report const& r = reports[i];
+        os << "  {\"participants\": " << r.shape.participants
+           << ", \"time_slots\": " << r.shape.time_slots
+           << ", \"polls\": " << r.polls
+           << ", \"errors\": " << r.errors
+           << ", \"late\": " << r.late
+           << ", \"latency_ms\": {\"min\": " << r.latency.min << ", \"median\": " << r.latency.median
+           << ", \"p95\": " << r.latency.p95 << ", \"p99\": " << r.latency.p99 << ", \"max\": " << r.latency.max
+           << "}, \"histogram_ms\": {";
+        for(std::size_t b = 0; b < r.latency.histogram.size(); ++b){
+            os << (b == 0 ? "" : ", ") << '"' << std::ldexp(1.0, b) << "\": " << r.latency.histogram[b];
+        }
+        os << (i + 1 == reports.size() ? "}}\n" : "}},\n");
+    }
+    os << "]}\n";
+}
+
+void write_csv(std::ostream& os, std::vector<shape_report> const& reports){
+    os << "participants,time_slots,polls,errors,late,min_ms,median_ms,p95_ms,p99_ms,max_ms\n";
+    for(shape_report const& r : reports){
+        os << r.shape.participants << ',' << r.shape.time_slots << ',' << r.polls << ','
+           << r.errors << ',' << r.late << ',' << r.latency.min << ',' << r.latency.median << ','
+           << r.latency.p95 << ',' << r.latency.p99 << ',' << r.latency.max << '\n';
+    }
+}
+
+int32_t read_load_options(int32_t* argcp, char*** argvp,
+		std::string* address1, std::string* address2, uint16_t* port1, uint16_t* port2,
+		std::string* certificate1, std::string* certificate2, uint32_t* polls, double* rate,
+		std::string* mix, uint32_t* connections, uint32_t* seed, std::string* format,
+		std::string* output) {
+
+	uint32_t int_port1 = 0, int_port2 = 0;
+
+	parsing_ctx options[] =
+			{ { (void*) address1, T_STR, "a",
+					"IP-address of server 1, default: localhost", false, false }, {
+					(void*) address2, T_STR, "b",
+					"IP-address of server 2, default: localhost", false, false }, {
+					(void*) &int_port1, T_NUM, "p", "Port of server 1, default: 7779", false,
+					false }, { (void*) &int_port2, T_NUM, "q",
+					"Port of server 2, default: 7775", false, false }, {
+					(void*) certificate1, T_STR, "k",
+					"Certificate of server 1, default: ../../src/examples/sec_doodle/certificate-1.cer",
+					false, false }, { (void*) certificate2, T_STR, "K",
+					"Certificate of server 2, default: ../../src/examples/sec_doodle/certificate-2.cer",
+					false, false }, { (void*) polls, T_NUM, "n",
+					"Number of polls, default: 100", false, false }, {
+					(void*) rate, T_DOUBLE, "R",
+					"Polls per second, 0 sends each poll as soon as the servers accept it, default: 1",
+					false, false }, { (void*) mix, T_STR, "m",
+					"Comma separated poll shapes participants x time slots[:weight], default: 10x10,100x20,1000x30",
+					false, false }, { (void*) connections, T_NUM, "c",
+					"Polls in flight at most, default: 16", false, false }, {
+					(void*) seed, T_NUM, "x",
+					"Seed of the generated polls, default: 1", false, false }, {
+					(void*) format, T_STR, "f",
+					"Output format, json or csv, default: json", false,
+					false }, { (void*) output, T_STR, "o",
+					"Output file, default: standard output", false, false } };
+
+	if (!parse_options(argcp, argvp, options,
+			sizeof(options) / sizeof(parsing_ctx))) {
+		print_usage(*argvp[0], options, sizeof(options) / sizeof(parsing_ctx));
+		std::cout << "Exiting" << std::endl;
+		exit(0);
+	}
+
+	if (int_port1 != 0) {
+		*port1 = (uint16_t) int_port1;
+	}
+	if (int_port2 != 0) {
+		*port2 = (uint16_t) int_port2;
+	}
+
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	std::string address1 = "localhost", address2 = "localhost";
+	uint16_t port1 = 7779, port2 = 7775;
+	std::string certificate1 = "../../src/examples/sec_doodle/certificate-1.cer",
+	            certificate2 = "../../src/examples/sec_doodle/certificate-2.cer";
+	std::string mix = "10x10,100x20,1000x30", format = "json", output;
+	uint32_t polls = 100, connections = 16, seed = 1;
+	double rate = 1;
+
+	read_load_options(&argc, &argv, &address1, &address2, &port1, &port2, &certificate1,
+			&certificate2, &polls, &rate, &mix, &connections, &seed, &format, &output);
+
+    if(format != "json" && format != "csv"){
+        std::cerr << "unknown output format " << format << std::endl;
+        return 1;
+    }
+    std::vector<poll_shape> const shapes = parse_mix(mix);
+
+    SSL_load_error_strings();
+    OpenSSL_add_ssl_algorithms();
+    endpoint server1(address1, port1, certificate1.c_str());
+    endpoint server2(address2, port2, certificate2.c_str());
+
+    //the shapes of the polls are drawn up front, so the same seed generates
+    //the same load
+    std::vector<std::size_t> poll_shapes(polls);
+    {
+        std::vector<double> weights;
+        for(poll_shape const& s : shapes){
+            weights.emplace_back(s.weight);
+        }
+        std::mt19937 rng(seed);
+        std::discrete_distribution<std::size_t> pick(weights.begin(), weights.end());
+        for(std::size_t& s : poll_shapes){
+            s = pick(rng);
+        }
+    }
+
+    //the polls are due at a fixed rate, independent of how fast the servers
+    //answer, so a slow server shows in the latencies instead of lowering the load
+    std::vector<poll_outcome> outcomes(polls);
+    connection_order order(polls);
+    std::atomic<std::size_t> next_poll{0};
+    load_clock::time_point const begin = load_clock::now();
+    auto const due = [&](std::size_t const poll){
+        return begin + std::chrono::duration_cast<load_clock::duration>(
+            std::chrono::duration<double>(rate > 0 ? poll / rate : 0)
+        );
+    };
+    auto worker = [&]{
+        for(std::size_t poll = next_poll++; poll < polls; poll = next_poll++){
+            poll_outcome outcome;
+            try{
+                outcome = run_poll(
+                    poll, shapes[poll_shapes[poll]], seed + static_cast<uint32_t>(poll) + 1,
+                    due(poll), server1, server2, order
+                );
+                if(!outcome.correct){
+                    std::cerr << "error: wrong result for poll " << poll << std::endl;
+                }
+            }
+            catch(std::runtime_error const& re){
+                std::cerr << "error: poll " << poll << ": " << re.what() << std::endl;
+                outcome.failed = true;
+            }
+            order.release(poll);
+            outcome.shape = poll_shapes[poll];
+            //without a rate every poll is due at the start
+            outcome.late = outcome.late && rate > 0;
+            outcomes[poll] = outcome;
+        }
+    };
+    std::vector<std::thread> workers;
+    for(uint32_t i = 0; i < std::max(connections, 1u); ++i){
+        workers.emplace_back(worker);
+    }
+    for(std::thread& t : workers){
+        t.join();
+    }
+    double const duration_s = std::chrono::duration<double>(load_clock::now() - begin).count();
+
+    std::vector<shape_report> reports;
+    std::size_t errors = 0;
+    for(std::size_t s = 0; s < shapes.size(); ++s){
+        std::vector<double> latencies;
+        std::size_t n = 0, shape_errors = 0, late = 0;
+        for(poll_outcome const& o : outcomes){
+            if(o.shape != s){
+                continue;
+            }
+            ++n;
+            shape_errors += !o.correct;
+            late += o.late;
+            if(!o.failed){
+                latencies.emplace_back(o.latency_ms);
+            }
+        }
+        errors += shape_errors;
+        reports.emplace_back(shape_report{shapes[s], n, shape_errors, late, latency_summary(std::move(latencies))});
+    }
+    std::cerr << polls << " polls in " << duration_s << " s, " << errors << " errors" << std::endl;
+    if(order.pairing_lost()){
+        std::cerr << "the servers lost the pairing of the polls, restart them before the next run" << std::endl;
+    }
+
+    std::ofstream of;
+    if(!output.empty()){
+        of.open(output);
+        if(!of){
+            std::cerr << "cannot open " << output << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& os = output.empty() ? std::cout : of;
+    if(format == "json"){
+        write_json(os, reports, polls, errors, duration_s);
+    }
+    else{
+        write_csv(os, reports);
+    }
+    return errors == 0 ? 0 : 1;
+}